@@ -12,6 +12,7 @@ package.path = lua_directory .. '/?.lua;' .. package.path
 package.path = lua_directory .. '/?/init.lua;' .. package.path
 
 local benchmark = require('wincent.commandt.private.benchmark')
+local c = require('wincent.commandt.private.lib.c')
 
 benchmark({
   config = 'wincent.commandt.benchmark.configs.scanner',
@@ -46,6 +47,12 @@ benchmark({
 
   run = function(config, setup)
     local scanner = setup.scanner(pwd) -- For now, only Watchman wants pwd.
+
+    if type(scanner) == 'cdata' then
+      -- Command-based scanners read their output in the background; wait for
+      -- all of it.
+      c.commandt_scanner_wait(scanner, 0xffffffff)
+    end
     for i = 1, scanner.count do
       ffi.string(scanner.candidates[i - 1].contents)
     end
@@ -9,6 +9,28 @@ local function skip_in_ci()
   return os.getenv('CI')
 end
 
+local paths_file = nil
+
+-- Returns the name of a file containing a big NUL-separated list of (made up)
+-- paths, creating it if necessary, for measuring how fast scanners can take in
+-- command output.
+local function get_paths_file()
+  if paths_file == nil then
+    paths_file = (os.getenv('TMPDIR') or '/tmp') .. '/commandt-benchmark-paths'
+    local file = assert(io.open(paths_file, 'wb'))
+    local parts = { 'src', 'lib', 'test', 'components', 'utils', 'vendor' }
+    for i = 1, 500000 do
+      local path = {}
+      for j = 1, i % 5 + 1 do
+        table.insert(path, parts[(i * j) % #parts + 1])
+      end
+      file:write(table.concat(path, '/'), '/file', i, '.c\0')
+    end
+    file:close()
+  end
+  return paths_file
+end
+
 return {
   variants = {
     {
@@ -329,6 +351,35 @@ return {
       times = times,
       skip = skip_in_ci,
     },
+    {
+      name = 'cat',
+      source = function()
+        local command = 'cat ' .. get_paths_file()
+        local scanner = require('wincent.commandt.private.scanners.exec').scanner
+        return {
+          scanner = function()
+            return scanner(command)
+          end,
+        }
+      end,
+      times = 10,
+    },
+    {
+      -- For comparison with "cat": the cost of just piping the same data.
+      name = 'cat (baseline)',
+      source = function()
+        local command = 'cat ' .. get_paths_file()
+        return {
+          scanner = function()
+            local handle = assert(io.popen(command, 'r'))
+            handle:read('*a')
+            handle:close()
+            return { count = 0 }
+          end,
+        }
+      end,
+      times = 10,
+    },
     {
       name = 'watchman',
       source = 'wincent.commandt.private.scanners.watchman',
@@ -6,24 +6,46 @@
 #ifndef COMMANDT_H
 #define COMMANDT_H
 
+#include <stdatomic.h> /* for _Atomic */
 #include <stdbool.h> /* for bool */
 #include <stddef.h> /* for size_t */
-#include <stdint.h> /* for uint32_t */
+#include <stdint.h> /* for uint32_t, uint64_t, uint8_t */
 
+#include "pool.h" /* for pool_t */
 #include "str.h" /* for str_t */
 
 /**
  *  Represents a single "haystack" (ie. a string to be searched for the needle).
+ *
+ *  Only candidates that actually get scored have their haystack touched during
+ *  a search; the state needed to reject the others lives in parallel arrays in
+ *  `matcher_t` (see `bitmasks` and `lengths`).
  */
 typedef struct {
     str_t *candidate;
-    long bitmask;
+
+    /**
+     * The candidate's lowercase copy in the scanner's `folded` buffer, or
+     * `NULL` if there isn't one.
+     */
+    const char *folded;
+
+    /**
+     * The candidate's slice of the scanner's `boundaries` buffer: one
+     * `boundary_t` (see "score.h") per byte of the candidate.
+     */
+    const uint8_t *boundaries;
+
     float score;
 } haystack_t;
 
 typedef struct {
     /**
      * Number of candidates currently stored in the scanner.
+     *
+     * For a scanner that is still being populated in the background (see
+     * `scanner_new_exec()`), this only goes up, and only when `scanner_wait()`
+     * is called.
      */
     unsigned count;
 
@@ -49,8 +71,91 @@ typedef struct {
      * Book-keeping detail, needed for call to `munmap()`.
      */
     ssize_t buffer_size;
+
+    /**
+     * @internal
+     *
+     * Index used by the matcher to narrow down searches in big scanners (see
+     * "ngram.h"); `NULL` until a matcher asks for it and it has been built
+     * (see `scanner_index()`).
+     */
+    struct ngram_index_t *index;
+
+    /**
+     * @internal
+     *
+     * Thread populating the scanner in the background; `NULL` once all of the
+     * candidates are in.
+     */
+    struct scanner_reader_t *reader;
+
+    /**
+     * @internal
+     *
+     * Thread building `index` in the background; `NULL` when there isn't one.
+     */
+    struct scanner_indexer_t *indexer;
+
+    /**
+     * @internal
+     *
+     * Lowercase copies of all of the candidates, laid end to end, which
+     * case-insensitive searches can compare against directly (see
+     * `scanner_fold()`); `NULL` until a matcher builds it.
+     */
+    char *folded;
+
+    /**
+     * @internal
+     *
+     * Book-keeping detail, needed for call to `munmap()`.
+     */
+    size_t folded_size;
+
+    /**
+     * @internal
+     *
+     * Number of candidates, and of bytes, already in `folded`.
+     */
+    unsigned folded_count;
+    size_t folded_length;
+
+    /**
+     * @internal
+     *
+     * What precedes each byte of each of the candidates, laid end to end,
+     * which saves the scorer from working it out over and over again (see
+     * `scanner_classify()`); `NULL` until a matcher builds it.
+     */
+    uint8_t *boundaries;
+
+    /**
+     * @internal
+     *
+     * Book-keeping detail, needed for call to `munmap()`.
+     */
+    size_t boundaries_size;
+
+    /**
+     * @internal
+     *
+     * Number of candidates, and of bytes, already in `boundaries`.
+     */
+    unsigned boundaries_count;
+    size_t boundaries_length;
 } scanner_t;
 
+/**
+ * A saved needle, along with the indices of the candidates that survived a
+ * search for it.
+ */
+typedef struct {
+    const char *needle;
+    size_t needle_length;
+    unsigned *survivors;
+    unsigned survivor_count;
+} needle_history_t;
+
 // TODO flesh this out; basically make it a container for instance variables
 typedef struct {
     /**
@@ -60,32 +165,136 @@ typedef struct {
     scanner_t *scanner;
     haystack_t *haystacks;
 
+    /**
+     * Number of entries in `haystacks` (and in the other per-candidate arrays
+     * below), which catches up with `scanner->count` at the start of each
+     * search.
+     */
+    unsigned haystack_count;
+
+    /**
+     * @internal
+     *
+     * Per-candidate bitmasks (see `commandt_bitmask()`), or `UNSET_BITMASK`
+     * for candidates that haven't been looked at yet, indexed like
+     * `haystacks`.
+     */
+    uint64_t *bitmasks;
+
+    /**
+     * @internal
+     *
+     * Per-candidate lengths, indexed like `haystacks`. Copied out of the
+     * scanner's `str_t` records so that pruning doesn't have to chase a pointer
+     * for every candidate.
+     */
+    unsigned *lengths;
+
+    /**
+     * @internal
+     *
+     * Per-candidate features used to bound scores when pruning (see
+     * `commandt_score_features()`), indexed like `haystacks`, and computed the
+     * first time each candidate gets as far as pruning.
+     */
+    struct score_features_t *features;
+
     bool always_show_dot_files;
+
+    /**
+     * Whether case-insensitive searches can compare against the lowercase
+     * copies of the candidates (see `haystack_t`). Note that, as another
+     * matcher may have built them, these may be in use even if this matcher
+     * wasn't asked to build them.
+     */
+    bool fold_candidates;
     bool ignore_case;
     bool ignore_spaces;
+
+    /**
+     * Whether to have the scanner build an index (see `scanner_index()`) to
+     * narrow down searches, if it is big enough.
+     */
+    bool index_candidates;
     bool never_show_dot_files;
     bool smart_case;
     // bool sort;
 
+    /**
+     * Whether `commandt_matcher_run()` and friends should report where in each
+     * match the needle matched (see `result_t`). Off by default.
+     */
+    bool record_positions;
+
     /**
      * Limit the number of returned results. Must be non-zero.
      */
     unsigned limit;
     unsigned threads;
 
+    /**
+     * @internal
+     *
+     * Worker threads used by `commandt_matcher_run()`; `NULL` when the matcher
+     * only ever needs to search on the calling thread.
+     */
+    pool_t *pool;
+
+    /**
+     * @internal
+     *
+     * Scratch space for the scorer, one per worker (ie. one more than the
+     * number of threads in `pool`).
+     */
+    struct score_scratch_t **scratch;
+
+    /**
+     * Latest generation number seen by `commandt_matcher_cancel()`; runs
+     * tagged with an earlier generation are abandoned.
+     */
+    _Atomic uint64_t generation;
+
     /**
      * Note that the matcher doesn't take ownership of the `needle` (ie. it
      * doesn't make a copy of it) because it only needs it to stick around long
      * enough to calculate scores with it. These fields are merely here as a
-     * convenience for temporarily threading state through to `commandt_score()`
-     * and friends.
+     * convenience for temporarily threading state through to the scorer and
+     * friends.
      */
     const char *needle;
     size_t needle_length;
-    long needle_bitmask;
+    uint64_t needle_bitmask;
 
     const char *last_needle;
     size_t last_needle_length;
+
+    /**
+     * @internal
+     *
+     * Indices (into `haystacks`) of the candidates that weren't ruled out by
+     * the last search. When the next needle extends `last_needle`, these are
+     * the only candidates that need to be looked at.
+     */
+    unsigned *survivors;
+    unsigned survivor_count;
+
+    /**
+     * @internal
+     *
+     * Same size as `survivors`; each search writes its survivors here, and then
+     * the two buffers are swapped.
+     */
+    unsigned *next_survivors;
+
+    /**
+     * @internal
+     *
+     * Stack of recent needles and their survivors, each entry a prefix of the
+     * one above it, so that deleting characters from the end of the needle can
+     * resume from an earlier survivor set instead of a full scan.
+     */
+    needle_history_t *history;
+    unsigned history_count;
 } matcher_t;
 
 typedef struct {
@@ -73,6 +73,19 @@ void heap_insert(heap_t *heap, void *value) {
     }
 }
 
+void heap_sort(heap_t *heap) {
+    unsigned count = heap->count;
+
+    // Each extraction frees up the slot just past the end of the shrunken
+    // heap, which is exactly where the extracted value belongs.
+    while (heap->count) {
+        void *extracted = heap_extract(heap);
+        heap->entries[heap->count] = extracted;
+    }
+
+    heap->count = count;
+}
+
 /**
  * Compare values at indices `a_idx` and `b_idx` using the heap's comparator
  * function.
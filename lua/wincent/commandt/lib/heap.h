@@ -17,6 +17,7 @@
 #define heap_free commandt_heap_free
 #define heap_insert commandt_heap_insert
 #define heap_new commandt_heap_new
+#define heap_sort commandt_heap_sort
 
 typedef int (*heap_compare_entries)(const void *a, const void *b);
 
@@ -49,4 +50,14 @@ void heap_insert(heap_t *heap, void *value);
  */
 heap_t *heap_new(unsigned capacity, heap_compare_entries comparator);
 
+/**
+ * Sorts the entries of `heap` in place (a heapsort), leaving them in the
+ * reverse of the order in which `heap_extract()` would have returned them.
+ *
+ * `heap->count` is unchanged, but the heap property no longer holds, so the
+ * only thing you can do with the heap afterwards is read its entries or free
+ * it.
+ */
+void heap_sort(heap_t *heap);
+
 #endif
@@ -6,19 +6,24 @@
 #include "matcher.h"
 
 #include <assert.h> /* for assert */
-#include <pthread.h> /* for pthread_create, pthread_join etc */
-#include <stdatomic.h> /* for atomic_fetch_add(), atomic_load() */
+#include <limits.h> /* for UINT_MAX */
+#include <pthread.h> /* for pthread_mutex_lock(), pthread_mutex_unlock() etc */
+#include <stdatomic.h> /* for atomic_fetch_add_explicit(), atomic_load() etc */
 #include <stdbool.h> /* for bool */
 #include <stddef.h> /* for size_t */
+#include <stdint.h> /* for uint8_t */
 #include <stdlib.h> /* for qsort(), NULL */
-#include <string.h> /* for strncmp() */
+#include <string.h> /* for memset(), strncmp() */
 
 #include "commandt.h" /* for haystack_t, matcher_t, scanner_t */
-#include "die.h" /* for die() */
-#include "heap.h" /* for HEAP_PEEK(), heap_extract(), heap_free(), heap_insert(), heap_new() */
-#include "score.h" /* for commandt_score() */
+#include "heap.h" /* for HEAP_PEEK(), heap_extract(), heap_insert(), heap_sort() etc */
+#include "ngram.h" /* for ngram_index_lookup() */
+#include "pool.h" /* for pool_free(), pool_new(), pool_run() */
+#include "prefilter.h" /* for prefilter() */
+#include "scanner.h" /* for scanner_fold(), scanner_index() etc */
+#include "score.h" /* for commandt_bitmask(), commandt_scorer() etc */
 #include "str.h" /* for str_t */
-#include "xmalloc.h" /* for xmalloc() */
+#include "xmalloc.h" /* for xcalloc(), xmalloc(), xrealloc() */
 
 // Avoid the overhead of threading when search space is small.
 #define THREAD_THRESHOLD 1000
@@ -26,28 +31,103 @@
 // Arbitrary limit to stop people from doing self-harm.
 #define MAX_THREADS 128
 
+// Number of needles to remember in `matcher->history`.
+#define HISTORY_DEPTH 16
+
+// Each worker will process a chunk of 64 consecutive haystacks at a time in
+// order maximize benefit of the CPU cache.
+#define CHUNK_SIZE 64
+
 typedef struct {
-    unsigned worker_count;
-    unsigned worker_index;
     matcher_t *matcher;
 
-    // May need to temporarily override matcher as a result of smart_case.
-    bool ignore_case;
+    // Start of the next chunk of haystacks waiting to be claimed by a worker.
+    // Chunks are handed out on demand (rather than in a fixed stride) so that
+    // workers that finish early keep taking work from the ones that don't.
+    atomic_uint next_chunk;
+
+    // When `survivors` is non-NULL, workers only look at the haystacks it
+    // lists (see `matcher_t`); otherwise, they look at all of them.
+    // `haystack_count` is the length of whichever of the two is in use.
+    const unsigned *survivors;
+    unsigned haystack_count;
+
+    // Next free slot in `matcher->next_survivors`.
+    atomic_uint next_survivor;
+
+    // Lowest score in the fullest heap seen so far (ie. the score a candidate
+    // must beat to make the final cut), shared so that each worker can prune
+    // using the best threshold found by any of them.
+    _Atomic float threshold;
+
+    // Workers give up when the matcher's generation moves past this one.
+    uint64_t generation;
+
+    // Chosen once per search; may temporarily override matcher's ignore_case
+    // as a result of smart_case.
+    scorer_t scorer;
+
+    unsigned worker_count;
+
+    // Streaming mode (see `commandt_matcher_run_streaming()`); `progress` is
+    // `NULL` when not streaming. Background workers periodically copy their
+    // heaps into their slots in `snapshots` (which has room for `limit` entries
+    // per worker), and every `progress_interval` candidates the calling thread
+    // merges the slots to produce a provisional result.
+    matcher_progress progress;
+    void *progress_context;
+    unsigned progress_interval;
+    pthread_mutex_t progress_mutex;
+    haystack_t **snapshots;
+    unsigned *snapshot_counts;
+    haystack_t **snapshot_matches;
+    result_t *snapshot_result;
 } worker_args_t;
 
+/**
+ * A run of haystacks, sorted best-first, waiting to be merged with others.
+ */
+typedef struct {
+    haystack_t **next;
+    haystack_t **end;
+} run_t;
+
 // Forward declarations.
-static long calculate_bitmask(const char *str, unsigned long length);
+static void catch_up(matcher_t *matcher);
 static int cmp_alpha(const void *a, const void *b);
-static int cmp_alpha_p(const void *a, const void *b);
+static int cmp_run(const void *a, const void *b);
 static int cmp_score(const void *a, const void *b);
 static int cmp_score_p(const void *a, const void *b);
-static void *get_matches(void *worker_args);
+static int cmp_str(const str_t *a_str, const str_t *b_str);
+static int cmp_str_p(const void *a, const void *b);
+static void *get_matches(void *worker_args, unsigned worker_index);
+static bool is_prefix(
+    const char *prefix,
+    size_t prefix_length,
+    const char *str,
+    size_t length
+);
+static void push_history(matcher_t *matcher);
+static void raise_threshold(_Atomic float *threshold, float score);
+static void publish_progress(
+    worker_args_t *worker_args,
+    unsigned worker_index,
+    heap_t *heap
+);
+static void select_matches(
+    matcher_t *matcher,
+    run_t *runs,
+    unsigned run_count,
+    result_t *results
+);
 
 matcher_t *commandt_matcher_new(
     scanner_t *scanner,
     bool always_show_dot_files,
+    bool fold_candidates,
     bool ignore_case,
     bool ignore_spaces,
+    bool index_candidates,
     unsigned limit,
     bool never_show_dot_files,
     bool smart_case,
@@ -61,43 +141,220 @@ matcher_t *commandt_matcher_new(
 
     matcher_t *matcher = xmalloc(sizeof(matcher_t));
     matcher->scanner = scanner;
-    matcher->haystacks = xmalloc(scanner->count * sizeof(haystack_t));
 
-    for (unsigned i = 0; i < scanner->count; i++) {
-        matcher->haystacks[i].candidate = &scanner->candidates[i];
-        matcher->haystacks[i].bitmask = UNSET_BITMASK;
-        matcher->haystacks[i].score = UNSET_SCORE;
-    }
+    // The per-candidate arrays get filled in by `catch_up()`.
+    matcher->haystacks = NULL;
+    matcher->haystack_count = 0;
+    matcher->bitmasks = NULL;
+    matcher->lengths = NULL;
+    matcher->features = NULL;
+    matcher->survivors = NULL;
+    matcher->next_survivors = NULL;
+    matcher->survivor_count = 0;
+    matcher->history = xmalloc(HISTORY_DEPTH * sizeof(needle_history_t));
+    matcher->history_count = 0;
 
     matcher->always_show_dot_files = always_show_dot_files;
+    matcher->fold_candidates = fold_candidates || scanner->folded;
     matcher->ignore_case = ignore_case;
     matcher->ignore_spaces = ignore_spaces;
+    matcher->index_candidates = index_candidates;
     matcher->never_show_dot_files = never_show_dot_files;
     matcher->smart_case = smart_case;
+    matcher->record_positions = false;
     matcher->limit = limit;
     matcher->threads = (unsigned int)threads;
+
+    // Threads (and their scratch space) get added by `catch_up()` if there
+    // turn out to be enough candidates to make them worthwhile.
+    matcher->pool = NULL;
+    matcher->scratch = xmalloc(sizeof(score_scratch_t *));
+    matcher->scratch[0] = commandt_score_scratch_new();
+
+    atomic_init(&matcher->generation, 0);
     matcher->needle = NULL;
     matcher->needle_length = 0;
     matcher->needle_bitmask = UNSET_BITMASK;
     matcher->last_needle = NULL;
     matcher->last_needle_length = 0;
 
+    // Take in whatever candidates the scanner has so far.
+    scanner_wait(scanner, 0);
+    catch_up(matcher);
+
     return matcher;
 }
 
+/**
+ * Extends the matcher's per-candidate arrays to cover all of the candidates in
+ * the scanner, whose count may have gone up since last time (see
+ * `scanner_wait()`), along with anything else that depends on that count.
+ */
+static void catch_up(matcher_t *matcher) {
+    scanner_t *scanner = matcher->scanner;
+    unsigned start = matcher->haystack_count;
+    unsigned count = scanner->count;
+
+    if (count > start) {
+        matcher->haystacks =
+            xrealloc(matcher->haystacks, count * sizeof(haystack_t));
+        matcher->bitmasks =
+            xrealloc(matcher->bitmasks, count * sizeof(uint64_t));
+        matcher->lengths = xrealloc(matcher->lengths, count * sizeof(unsigned));
+        matcher->features =
+            xrealloc(matcher->features, count * sizeof(score_features_t));
+        memset(
+            matcher->features + start,
+            0,
+            (count - start) * sizeof(score_features_t)
+        );
+        matcher->survivors =
+            xrealloc(matcher->survivors, count * sizeof(unsigned));
+        matcher->next_survivors =
+            xrealloc(matcher->next_survivors, count * sizeof(unsigned));
+
+        // Earlier searches never saw the new candidates, so can't be used to
+        // rule any of them out.
+        for (unsigned i = 0; i < matcher->history_count; i++) {
+            free((void *)matcher->history[i].needle);
+            free(matcher->history[i].survivors);
+        }
+        matcher->history_count = 0;
+        free((void *)matcher->last_needle);
+        matcher->last_needle = NULL;
+        matcher->last_needle_length = 0;
+        matcher->survivor_count = 0;
+
+        // These are built once, and then extended and shared by all matchers
+        // using this scanner.
+        if (matcher->fold_candidates) {
+            scanner_fold(scanner);
+        }
+        scanner_classify(scanner);
+
+        // Each candidate's slices of these follow on from the previous one's.
+        const char *folded = NULL;
+        const uint8_t *boundaries = scanner->boundaries;
+        if (matcher->fold_candidates) {
+            folded = scanner->folded;
+        }
+        if (start) {
+            haystack_t *last = &matcher->haystacks[start - 1];
+            if (folded) {
+                folded = last->folded + matcher->lengths[start - 1];
+            }
+            boundaries = last->boundaries + matcher->lengths[start - 1];
+        }
+
+        for (unsigned i = start; i < count; i++) {
+            matcher->haystacks[i].candidate = &scanner->candidates[i];
+            matcher->haystacks[i].folded = folded;
+            if (folded) {
+                folded += scanner->candidates[i].length;
+            }
+            matcher->haystacks[i].boundaries = boundaries;
+            boundaries += scanner->candidates[i].length;
+            matcher->haystacks[i].score = UNSET_SCORE;
+            matcher->bitmasks[i] = UNSET_BITMASK;
+            matcher->lengths[i] = scanner->candidates[i].length;
+        }
+        matcher->haystack_count = count;
+
+        // Threads are long-lived so that each run only needs to wake them up;
+        // as with the calling thread, which does a share of the work itself,
+        // we don't bother with them at all when the search space is small.
+        if (!matcher->pool && matcher->threads > 1 &&
+            count >= THREAD_THRESHOLD) {
+            matcher->pool = pool_new(matcher->threads - 1);
+            unsigned worker_count = matcher->pool->count + 1;
+            matcher->scratch = xrealloc(
+                matcher->scratch, worker_count * sizeof(score_scratch_t *)
+            );
+            for (unsigned i = 1; i < worker_count; i++) {
+                matcher->scratch[i] = commandt_score_scratch_new();
+            }
+        }
+    }
+
+    // Built once, in the background, and then shared by all matchers using
+    // this scanner; searches do without it until it's ready.
+    if (matcher->index_candidates) {
+        scanner_index(scanner, matcher->threads);
+    }
+}
+
+void commandt_matcher_cancel(matcher_t *matcher, uint64_t generation) {
+    uint64_t current = atomic_load(&matcher->generation);
+    while (current < generation) {
+        // On failure, `current` gets updated with the latest value.
+        if (atomic_compare_exchange_weak(
+                &matcher->generation, &current, generation
+            )) {
+            break;
+        }
+    }
+}
+
 void commandt_matcher_free(matcher_t *matcher) {
     // Note that we don't free the scanner here (the scanner's owner is
     // responsible for freeing it).
+    unsigned worker_count = 1;
+    if (matcher->pool) {
+        worker_count += matcher->pool->count;
+        pool_free(matcher->pool);
+    }
+    for (unsigned i = 0; i < worker_count; i++) {
+        commandt_score_scratch_free(matcher->scratch[i]);
+    }
+    free(matcher->scratch);
     free(matcher->haystacks);
+    free(matcher->bitmasks);
+    free(matcher->lengths);
+    free(matcher->features);
+    free(matcher->survivors);
+    free(matcher->next_survivors);
+    for (unsigned i = 0; i < matcher->history_count; i++) {
+        free((void *)matcher->history[i].needle);
+        free(matcher->history[i].survivors);
+    }
+    free(matcher->history);
     free((void *)matcher->last_needle);
     free(matcher);
 }
 
 result_t *commandt_matcher_run(matcher_t *matcher, const char *needle) {
+    return commandt_matcher_run_generation(
+        matcher, needle, atomic_load(&matcher->generation)
+    );
+}
+
+result_t *commandt_matcher_run_generation(
+    matcher_t *matcher,
+    const char *needle,
+    uint64_t generation
+) {
+    return commandt_matcher_run_streaming(
+        matcher, needle, generation, 0, NULL, NULL
+    );
+}
+
+result_t *commandt_matcher_run_streaming(
+    matcher_t *matcher,
+    const char *needle,
+    uint64_t generation,
+    unsigned interval,
+    matcher_progress progress,
+    void *context
+) {
     scanner_t *scanner = matcher->scanner;
-    unsigned candidate_count = scanner->count;
+
+    // Take in any candidates that have arrived since last time, waiting for
+    // the first one if there aren't any yet (so that a scanner that is merely
+    // slow to get going doesn't look empty).
+    scanner_wait(scanner, 1);
+    catch_up(matcher);
+    unsigned candidate_count = matcher->haystack_count;
     unsigned limit = matcher->limit;
-    atomic_uint matches_count = 0;
 
     size_t needle_length = strlen(needle);
     char *needle_copy = xmalloc(needle_length + 1);
@@ -142,25 +399,18 @@ result_t *commandt_matcher_run(matcher_t *matcher, const char *needle) {
     matcher->needle = needle_copy;
     matcher->needle_length = needle_length;
 
-    if (matcher->last_needle) {
-        // Will compare against previously computed haystack bitmasks.
-        matcher->needle_bitmask =
-            calculate_bitmask(matcher->needle, needle_length);
+    // Will compare against previously computed haystack bitmasks.
+    matcher->needle_bitmask = commandt_bitmask(matcher->needle, needle_length);
 
+    if (matcher->last_needle) {
         // Check whether current search extends previous search; if so, we can
         // skip all the non-matches from last time without looking at them.
-        bool is_extension = false;
-        if (needle_length >= matcher->last_needle_length) {
-            is_extension = true;
-            unsigned long index = 0;
-            while (index < matcher->last_needle_length) {
-                if (matcher->needle[index] != matcher->last_needle[index]) {
-                    is_extension = false;
-                    break;
-                }
-                index++;
-            }
-        }
+        bool is_extension = is_prefix(
+            matcher->last_needle,
+            matcher->last_needle_length,
+            matcher->needle,
+            needle_length
+        );
         if (!is_extension) {
             free((void *)matcher->last_needle);
             matcher->last_needle = NULL;
@@ -168,79 +418,171 @@ result_t *commandt_matcher_run(matcher_t *matcher, const char *needle) {
         }
     }
 
-    unsigned worker_count = matcher->threads > 0 ? matcher->threads : 1;
-    if (candidate_count < THREAD_THRESHOLD) {
-        worker_count = 1;
-    }
-
-    // Get unsorted matches.
+    // If the current search extends the previous one, we only need to look
+    // at the candidates that survived last time.
+    const unsigned *survivors =
+        matcher->last_needle ? matcher->survivors : NULL;
+    unsigned haystack_count =
+        survivors ? matcher->survivor_count : candidate_count;
 
-    haystack_t **matches = xmalloc(worker_count * limit * sizeof(haystack_t *));
-    pthread_t *threads = xmalloc(worker_count * sizeof(pthread_t));
-    worker_args_t *worker_args = xmalloc(worker_count * sizeof(worker_args_t));
-
-    for (unsigned i = 0; i < worker_count; i++) {
-        worker_args[i].worker_count = worker_count;
-        worker_args[i].worker_index = i;
-        worker_args[i].matcher = matcher;
-        worker_args[i].ignore_case = ignore_case;
-
-        if (i == worker_count - 1) {
-            // For the last worker, we'll just use the main thread.
-            heap_t *heap = get_matches(&worker_args[i]);
-            unsigned offset = atomic_fetch_add(&matches_count, heap->count);
-            memcpy(
-                matches + offset, heap->entries, heap->count * sizeof(haystack_t *)
-            );
-            heap_free(heap);
-        } else {
-            int err = pthread_create(
-                &threads[i], NULL, get_matches, (void *)&worker_args[i]
-            );
-            if (err != 0) {
-                die("phthread_create() failed", err);
+    // Otherwise (typically, after a backspace), we may be able to pick up from
+    // the survivors of an earlier search.
+    while (matcher->history_count) {
+        needle_history_t *top = &matcher->history[matcher->history_count - 1];
+        if (is_prefix(
+                top->needle, top->needle_length, needle_copy, needle_length
+            )) {
+            if (!survivors) {
+                survivors = top->survivors;
+                haystack_count = top->survivor_count;
             }
+            break;
         }
+        free((void *)top->needle);
+        free(top->survivors);
+        matcher->history_count--;
     }
 
-    for (long i = 0; i < worker_count - 1; i++) {
-        heap_t *heap;
-        int err = pthread_join(threads[i], (void **)&heap);
-        if (err != 0) {
-            die("phtread_join() failed", err);
-        }
-        unsigned offset = atomic_fetch_add(&matches_count, heap->count);
-        memcpy(
-            matches + offset, heap->entries, heap->count * sizeof(haystack_t *)
+    // Failing that, in big scanners, the index may be able to narrow things
+    // down.
+    unsigned *indexed = NULL;
+    if (!survivors && needle_length >= 3 && scanner->index) {
+        unsigned indexed_count;
+        indexed = ngram_index_lookup(
+            scanner->index, needle_copy, needle_length, &indexed_count
         );
-        heap_free(heap);
+        if (indexed) {
+            survivors = indexed;
+            haystack_count = indexed_count;
+        }
     }
 
-    free(threads);
-    free(worker_args);
+    unsigned worker_count = matcher->pool ? matcher->pool->count + 1 : 1;
+    if (haystack_count < THREAD_THRESHOLD) {
+        worker_count = 1;
+    }
 
-    unsigned count = atomic_load(&matches_count);
-    if (needle_length == 0 || (needle_length == 1 && matcher->needle[0] == '.')) {
-        // Alphabetic order if search string is only "" or "."
-        qsort(matches, count, sizeof(haystack_t *), cmp_alpha_p);
+    // Get matches (each worker returns a heap sorted best-first).
+
+    heap_t *heaps[MAX_THREADS];
+    worker_args_t worker_args = {
+        .matcher = matcher,
+        .generation = generation,
+        .scorer = commandt_scorer(matcher, ignore_case),
+        .worker_count = worker_count,
+        .progress = progress,
+        .progress_context = context,
+    };
+    atomic_init(&worker_args.next_chunk, 0);
+    worker_args.survivors = survivors;
+    worker_args.haystack_count = haystack_count;
+    atomic_init(&worker_args.next_survivor, 0);
+    atomic_init(&worker_args.threshold, 0.0f);
+
+    if (progress) {
+        worker_args.progress_interval = interval > 0 ? interval : CHUNK_SIZE;
+        pthread_mutex_init(&worker_args.progress_mutex, NULL);
+        worker_args.snapshots =
+            xmalloc(worker_count * limit * sizeof(haystack_t *));
+        worker_args.snapshot_counts = xcalloc(worker_count, sizeof(unsigned));
+        worker_args.snapshot_matches =
+            xmalloc(worker_count * limit * sizeof(haystack_t *));
+        worker_args.snapshot_result = xmalloc(sizeof(result_t));
+        worker_args.snapshot_result->matches =
+            xmalloc(limit * sizeof(const char *));
+        worker_args.snapshot_result->candidate_count = candidate_count;
+        worker_args.snapshot_result->positions = NULL;
+        worker_args.snapshot_result->position_count = 0;
+        worker_args.snapshot_result->cancelled = false;
+    }
+
+    if (worker_count == 1) {
+        heaps[0] = get_matches(&worker_args, 0);
     } else {
-        qsort(matches, count, sizeof(haystack_t *), cmp_score_p);
+        pool_run(
+            matcher->pool,
+            worker_count,
+            get_matches,
+            &worker_args,
+            (void **)heaps
+        );
     }
 
+    if (progress) {
+        pthread_mutex_destroy(&worker_args.progress_mutex);
+        free(worker_args.snapshots);
+        free(worker_args.snapshot_counts);
+        free(worker_args.snapshot_matches);
+        commandt_result_free(worker_args.snapshot_result);
+    }
+    free(indexed);
+
     result_t *results = xmalloc(sizeof(result_t));
     results->matches = xmalloc(limit * sizeof(const char *));
     results->match_count = 0;
     results->candidate_count = candidate_count;
+    results->positions = NULL;
+    results->position_count = 0;
+    results->cancelled = generation < atomic_load(&matcher->generation);
 
-    for (long i = 0; i < count && results->match_count < limit; i++) {
-        if (matches[i]->score > 0.0f) {
-            results->matches[results->match_count++] = matches[i]->candidate;
+    if (results->cancelled) {
+        // Workers stopped part-way through, so only some haystacks have
+        // up-to-date scores; forget the needle so that the next search
+        // can't use them to skip candidates.
+        for (unsigned i = 0; i < worker_count; i++) {
+            heap_free(heaps[i]);
         }
+        free((void *)matcher->last_needle);
+        free((void *)matcher->needle);
+        matcher->last_needle = NULL;
+        matcher->last_needle_length = 0;
+        matcher->needle = NULL;
+        matcher->needle_length = 0;
+        return results;
     }
 
-    free(matches);
+    run_t runs[MAX_THREADS];
+    for (unsigned i = 0; i < worker_count; i++) {
+        runs[i].next = (haystack_t **)heaps[i]->entries;
+        runs[i].end = runs[i].next + heaps[i]->count;
+    }
+    select_matches(matcher, runs, worker_count, results);
+    for (unsigned i = 0; i < worker_count; i++) {
+        heap_free(heaps[i]);
+    }
+
+    // Only now that we know which matches made the cut do we go back and find
+    // out where they matched.
+    if (matcher->record_positions && needle_length && results->match_count) {
+        results->position_count = needle_length;
+        results->positions = xcalloc(
+            (size_t)results->match_count * needle_length, sizeof(unsigned)
+        );
+        for (unsigned i = 0; i < results->match_count; i++) {
+            unsigned *row = results->positions + (size_t)i * needle_length;
+            bool found = commandt_score_positions(
+                results->matches[i],
+                matcher,
+                ignore_case,
+                matcher->scratch[0],
+                row
+            );
+            if (!found) {
+                // Shouldn't happen (it scored, so it matches), but if it does,
+                // make it obvious that there is nothing to highlight.
+                for (unsigned j = 0; j < needle_length; j++) {
+                    row[j] = UINT_MAX;
+                }
+            }
+        }
+    }
 
     // Save this state to potentially speed subsequent searches.
+    unsigned *next_survivors = matcher->next_survivors;
+    matcher->next_survivors = matcher->survivors;
+    matcher->survivors = next_survivors;
+    matcher->survivor_count = atomic_load(&worker_args.next_survivor);
+    push_history(matcher);
     free((void *)matcher->last_needle);
     matcher->last_needle = matcher->needle;
     matcher->last_needle_length = needle_length;
@@ -250,37 +592,25 @@ result_t *commandt_matcher_run(matcher_t *matcher, const char *needle) {
 
 void commandt_result_free(result_t *result) {
     free(result->matches);
+    free(result->positions);
     free(result);
 }
 
-static long calculate_bitmask(const char *str, unsigned long length) {
-    long mask = 0;
-    for (unsigned long i = 0; i < length; i++) {
-        if (str[i] >= 'a' && str[i] <= 'z') {
-            mask |= (1 << (str[i] - 'a'));
-        } else if (str[i] >= 'A' && str[i] <= 'Z') {
-            mask |= (1 << (str[i] - 'A'));
-        }
-    }
-    return mask;
-}
-
 /**
  * Comparison function for use with `heap_new()`.
  */
 static int cmp_alpha(const void *a, const void *b) {
-    str_t *a_str = ((haystack_t *)a)->candidate;
-    str_t *b_str = ((haystack_t *)b)->candidate;
-    const char *a_ptr = a_str->contents;
-    const char *b_ptr = b_str->contents;
-    size_t a_len = a_str->length;
-    size_t b_len = b_str->length;
-    int order = strncmp(a_ptr, b_ptr, b_len);
-    if (order == 0) {
-        return (long)a_len - (long)b_len; // Shorter string wins.
-    } else {
-        return order;
-    }
+    return cmp_str(((haystack_t *)a)->candidate, ((haystack_t *)b)->candidate);
+}
+
+/**
+ * Comparison function for use with `heap_new()` to merge runs.
+ *
+ * The order is reversed relative to `cmp_score()`, so that the run with the
+ * best next haystack is at the top of the heap.
+ */
+static int cmp_run(const void *a, const void *b) {
+    return cmp_score(*((run_t *)b)->next, *((run_t *)a)->next);
 }
 
 /**
@@ -301,27 +631,57 @@ static int cmp_score(const void *a, const void *b) {
 /**
  * Comparison function for use with `qsort()`.
  */
-static int cmp_alpha_p(const void *a, const void *b) {
+static int cmp_score_p(const void *a, const void *b) {
     haystack_t *a_haystack = *((haystack_t **)a);
     haystack_t *b_haystack = *((haystack_t **)b);
-    return cmp_alpha(a_haystack, b_haystack);
+    return cmp_score(a_haystack, b_haystack);
+}
+
+/**
+ * Alphabetical comparison of candidate strings, shared by `cmp_alpha()` and
+ * `cmp_str_p()`.
+ */
+static int cmp_str(const str_t *a_str, const str_t *b_str) {
+    const char *a_ptr = a_str->contents;
+    const char *b_ptr = b_str->contents;
+    size_t a_len = a_str->length;
+    size_t b_len = b_str->length;
+    int order = strncmp(a_ptr, b_ptr, b_len);
+    if (order == 0) {
+        return (long)a_len - (long)b_len; // Shorter string wins.
+    } else {
+        return order;
+    }
 }
 
 /**
  * Comparison function for use with `qsort()`.
  */
-static int cmp_score_p(const void *a, const void *b) {
-    haystack_t *a_haystack = *((haystack_t **)a);
-    haystack_t *b_haystack = *((haystack_t **)b);
-    return cmp_score(a_haystack, b_haystack);
+static int cmp_str_p(const void *a, const void *b) {
+    return cmp_str(*((str_t **)a), *((str_t **)b));
 }
 
-static void *get_matches(void *worker_args) {
-    unsigned worker_count = ((worker_args_t *)worker_args)->worker_count;
-    unsigned worker_index = ((worker_args_t *)worker_args)->worker_index;
+static void *get_matches(void *worker_args, unsigned worker_index) {
+    atomic_uint *next_chunk = &((worker_args_t *)worker_args)->next_chunk;
+    _Atomic float *shared_threshold =
+        &((worker_args_t *)worker_args)->threshold;
+    uint64_t generation = ((worker_args_t *)worker_args)->generation;
     matcher_t *matcher = ((worker_args_t *)worker_args)->matcher;
-    bool ignore_case = ((worker_args_t *)worker_args)->ignore_case;
+    scorer_t scorer = ((worker_args_t *)worker_args)->scorer;
+    unsigned worker_count = ((worker_args_t *)worker_args)->worker_count;
+    matcher_progress progress = ((worker_args_t *)worker_args)->progress;
+    unsigned progress_interval =
+        ((worker_args_t *)worker_args)->progress_interval;
+    bool is_calling_thread = worker_index == worker_count - 1;
+    const unsigned *survivors = ((worker_args_t *)worker_args)->survivors;
+    unsigned haystack_count = ((worker_args_t *)worker_args)->haystack_count;
+    atomic_uint *next_survivor =
+        &((worker_args_t *)worker_args)->next_survivor;
     size_t needle_length = matcher->needle_length;
+    uint64_t needle_bitmask = matcher->needle_bitmask;
+    const uint64_t *bitmasks = matcher->bitmasks;
+    const unsigned *lengths = matcher->lengths;
+    score_scratch_t *scratch = matcher->scratch[worker_index];
 
     // The empty query and the lone "." query are ordered alphabetically;
     // otherwise we sort by score.
@@ -334,70 +694,343 @@ static void *get_matches(void *worker_args) {
     // top-"limit" list of items).
     heap_t *heap = heap_new(matcher->limit + 1, cmp_score);
 
-    // Each worker will process a chunk of 64 consecutive needles at a time in
-    // order maximize benefit of the CPU cache.
-    unsigned chunk_size = 64;
-    for (unsigned chunk_start = worker_index * chunk_size;
-         chunk_start < matcher->scanner->count;
-         chunk_start += worker_count * chunk_size) {
-        unsigned chunk_end = chunk_start + chunk_size;
-        if (chunk_end > matcher->scanner->count) {
-            chunk_end = matcher->scanner->count;
+    // For streaming: background workers publish after processing their share
+    // of each interval, while the calling thread reports whenever the workers
+    // as a group have advanced by another interval.
+    unsigned publish_interval = progress_interval / worker_count;
+    unsigned unpublished = 0;
+    unsigned next_report = progress_interval;
+
+    while (true) {
+        if (generation <
+            atomic_load_explicit(&matcher->generation, memory_order_relaxed)) {
+            // A newer search has superseded this one.
+            break;
         }
-        for (unsigned i = chunk_start; i < chunk_end; i++) {
-            haystack_t *haystack = matcher->haystacks + i;
-            if (matcher->needle_bitmask == UNSET_BITMASK) {
-                haystack->bitmask = UNSET_BITMASK;
-            }
-            if (matcher->last_needle != NULL && haystack->score == 0.0f) {
-                // Skip over this candidate because it didn't match last
-                // time and it can't match this time either.
-                continue;
-            }
+        unsigned chunk_start = atomic_fetch_add_explicit(
+            next_chunk, CHUNK_SIZE, memory_order_relaxed
+        );
+        if (chunk_start >= haystack_count) {
+            break;
+        }
+        unsigned chunk_end = chunk_start + CHUNK_SIZE;
+        if (chunk_end > haystack_count) {
+            chunk_end = haystack_count;
+        }
+
+        // Survivors from this chunk, to be flushed to
+        // `matcher->next_survivors` in one go at the end of the chunk.
+        unsigned chunk_survivors[CHUNK_SIZE];
+        unsigned chunk_survivor_count = 0;
+
+        // Cheap rejection, using only the packed per-candidate bitmasks, of
+        // the candidates that can't possibly match.
+        unsigned candidates[CHUNK_SIZE];
+        unsigned candidate_count = prefilter(
+            bitmasks,
+            survivors,
+            chunk_start,
+            chunk_end - chunk_start,
+            needle_bitmask,
+            candidates
+        );
+
+        for (unsigned i = 0; i < candidate_count; i++) {
+            unsigned index = candidates[i];
+
+            // Skip scoring entirely for candidates that can't
+            // possibly make the final cut.
+            if (sort_by_score) {
+                // Once any worker's heap is full (ie. `heap->count ==
+                // matcher->limit`), the smallest score it holds is the
+                // threshold a candidate must reach to be among the best
+                // `limit` matches overall.
+                float threshold = atomic_load_explicit(
+                    shared_threshold, memory_order_relaxed
+                );
+                if (heap->count == matcher->limit) {
+                    float own = ((haystack_t *)HEAP_PEEK(heap))->score;
+                    if (own > threshold) {
+                        threshold = own;
+                    }
+                }
+                size_t candidate_length = lengths[index];
+                if (threshold > 0.0f && candidate_length > 0) {
+                    // Slack to avoid false positives due to rounding errors
+                    // (repeated floating-point additions in the scorer).
+                    float slack = 1.0e-4f;
 
-            // Skip `commandt_score()` entirely for candidates that can't
-            // possibly enter the heap.
-            if (sort_by_score && heap->count == matcher->limit) {
-                size_t candidate_length = haystack->candidate->length;
-                if (candidate_length > 0) {
-                    // Once the heap is full (ie. `heap->count ==
-                    // matcher->limit`), the smallest score it holds is
-                    // the threshold a candidate must reach to displace
-                    // anything. Each matched character contributes at most
+                    // Each matched character contributes at most
                     // `max_score_per_char` to the score, so `needle_length *
                     // max_score_per_char` is an upper bound on any score this
-                    // candidate could achieve.
-                    float threshold = ((haystack_t *)HEAP_PEEK(heap))->score;
+                    // candidate could achieve. Only if that isn't enough to
+                    // rule it out do we go to the trouble of working out a
+                    // tighter one.
                     float max_score_per_char =
                         (1.0f / candidate_length + 1.0f / needle_length) / 2.0f;
                     float upper_bound = needle_length * max_score_per_char;
-
-                    // Slack to avoid false positives due to rounding errors
-                    // (repeated floating-point additions in the scorer).
-                    float slack = 1.0e-4f;
+                    if (upper_bound * (1.0f + slack) >= threshold) {
+                        score_features_t *features = matcher->features + index;
+                        if (!features->set) {
+                            str_t *candidate =
+                                matcher->haystacks[index].candidate;
+                            commandt_score_features(
+                                candidate->contents, candidate->length, features
+                            );
+                        }
+                        upper_bound = commandt_score_bound(
+                            features,
+                            matcher->needle,
+                            needle_length,
+                            max_score_per_char
+                        );
+                    }
                     if (upper_bound * (1.0f + slack) < threshold) {
+                        // We never scored this candidate, so it might yet
+                        // match an extension of the current needle.
+                        chunk_survivors[chunk_survivor_count++] = index;
                         continue;
                     }
                 }
             }
 
-            haystack->score = commandt_score(haystack, matcher, ignore_case);
+            haystack_t *haystack = matcher->haystacks + index;
+            haystack->score =
+                scorer(haystack, matcher->bitmasks + index, matcher, scratch);
 
             if (haystack->score == 0.0f) {
+                // Didn't match this time, so can't match any extension of
+                // the current needle either.
                 continue;
             }
+            chunk_survivors[chunk_survivor_count++] = index;
 
             if (heap->count == matcher->limit) {
                 float score = ((haystack_t *)HEAP_PEEK(heap))->score;
                 if (haystack->score >= score) {
                     heap_insert(heap, haystack);
                     (void)heap_extract(heap);
+                    if (sort_by_score) {
+                        raise_threshold(
+                            shared_threshold,
+                            ((haystack_t *)HEAP_PEEK(heap))->score
+                        );
+                    }
                 }
             } else {
                 heap_insert(heap, haystack);
+                if (sort_by_score && heap->count == matcher->limit) {
+                    raise_threshold(
+                        shared_threshold, ((haystack_t *)HEAP_PEEK(heap))->score
+                    );
+                }
+            }
+        }
+
+        if (chunk_survivor_count) {
+            unsigned offset = atomic_fetch_add_explicit(
+                next_survivor, chunk_survivor_count, memory_order_relaxed
+            );
+            memcpy(
+                matcher->next_survivors + offset,
+                chunk_survivors,
+                chunk_survivor_count * sizeof(unsigned)
+            );
+        }
+
+        if (progress) {
+            unpublished += chunk_end - chunk_start;
+            if (is_calling_thread) {
+                if (chunk_end >= next_report) {
+                    next_report = chunk_end + progress_interval;
+                    publish_progress(worker_args, worker_index, heap);
+                }
+            } else if (unpublished >= publish_interval) {
+                unpublished = 0;
+                publish_progress(worker_args, worker_index, heap);
             }
         }
     }
 
+    // Sorting here, rather than after the join, lets the workers do it in
+    // parallel.
+    heap_sort(heap);
+
     return heap;
 }
+
+/**
+ * Returns `true` if the first `prefix_length` bytes of `prefix` are a prefix
+ * of the first `length` bytes of `str`.
+ */
+static bool is_prefix(
+    const char *prefix,
+    size_t prefix_length,
+    const char *str,
+    size_t length
+) {
+    return prefix_length <= length && memcmp(prefix, str, prefix_length) == 0;
+}
+
+/**
+ * Saves a copy of the current needle and its survivors on top of
+ * `matcher->history`.
+ *
+ * Expects the entries already on the stack to be prefixes of the current
+ * needle.
+ */
+static void push_history(matcher_t *matcher) {
+    if (matcher->survivor_count == matcher->haystack_count) {
+        // Nothing was ruled out, so there's nothing to gain over a full scan.
+        return;
+    }
+
+    if (matcher->history_count) {
+        needle_history_t *top = &matcher->history[matcher->history_count - 1];
+        if (top->needle_length == matcher->needle_length) {
+            // Same needle as last time; nothing new to remember.
+            return;
+        }
+    }
+
+    if (matcher->history_count == HISTORY_DEPTH) {
+        // Drop the oldest (and biggest) entry.
+        free((void *)matcher->history[0].needle);
+        free(matcher->history[0].survivors);
+        memmove(
+            matcher->history,
+            matcher->history + 1,
+            (HISTORY_DEPTH - 1) * sizeof(needle_history_t)
+        );
+        matcher->history_count--;
+    }
+
+    needle_history_t *entry = &matcher->history[matcher->history_count++];
+    char *needle = xmalloc(matcher->needle_length + 1);
+    memcpy(needle, matcher->needle, matcher->needle_length + 1);
+    entry->needle = needle;
+    entry->needle_length = matcher->needle_length;
+    entry->survivor_count = matcher->survivor_count;
+    entry->survivors = xmalloc(matcher->survivor_count * sizeof(unsigned));
+    memcpy(
+        entry->survivors,
+        matcher->survivors,
+        matcher->survivor_count * sizeof(unsigned)
+    );
+}
+
+/**
+ * Raises the shared pruning `threshold` to `score`, unless another worker has
+ * already raised it higher.
+ */
+static void raise_threshold(_Atomic float *threshold, float score) {
+    float current = atomic_load_explicit(threshold, memory_order_relaxed);
+    while (score > current) {
+        // On failure, `current` gets updated with the latest value.
+        if (atomic_compare_exchange_weak_explicit(
+                threshold,
+                &current,
+                score,
+                memory_order_relaxed,
+                memory_order_relaxed
+            )) {
+            break;
+        }
+    }
+}
+
+/**
+ * Copies the worker's `heap` into its snapshot slot. When called on the
+ * calling thread (ie. the last worker), also merges all the slots into a
+ * provisional result and hands it to the progress callback.
+ */
+static void publish_progress(
+    worker_args_t *worker_args,
+    unsigned worker_index,
+    heap_t *heap
+) {
+    matcher_t *matcher = worker_args->matcher;
+    unsigned limit = matcher->limit;
+    unsigned worker_count = worker_args->worker_count;
+    bool is_calling_thread = worker_index == worker_count - 1;
+    haystack_t **slot = worker_args->snapshots + worker_index * limit;
+    run_t runs[MAX_THREADS];
+
+    pthread_mutex_lock(&worker_args->progress_mutex);
+    memcpy(slot, heap->entries, heap->count * sizeof(haystack_t *));
+    qsort(slot, heap->count, sizeof(haystack_t *), cmp_score_p);
+    worker_args->snapshot_counts[worker_index] = heap->count;
+    if (is_calling_thread) {
+        // Copy the slots, because they may be overwritten as soon as we
+        // release the lock.
+        haystack_t **next = worker_args->snapshot_matches;
+        for (unsigned i = 0; i < worker_count; i++) {
+            unsigned count = worker_args->snapshot_counts[i];
+            memcpy(
+                next,
+                worker_args->snapshots + i * limit,
+                count * sizeof(haystack_t *)
+            );
+            runs[i].next = next;
+            runs[i].end = next + count;
+            next += count;
+        }
+    }
+    pthread_mutex_unlock(&worker_args->progress_mutex);
+
+    if (is_calling_thread) {
+        // Each haystack is scored by exactly one worker, so the scores of those
+        // in the snapshot won't change underneath us.
+        select_matches(
+            matcher, runs, worker_count, worker_args->snapshot_result
+        );
+        worker_args->progress(
+            worker_args->snapshot_result, worker_args->progress_context
+        );
+    }
+}
+
+/**
+ * Merges the best-first sorted `runs`, recording the best `matcher->limit`
+ * matches in `results`.
+ */
+static void select_matches(
+    matcher_t *matcher,
+    run_t *runs,
+    unsigned run_count,
+    result_t *results
+) {
+    heap_t *heads = heap_new(run_count, cmp_run);
+    for (unsigned i = 0; i < run_count; i++) {
+        if (runs[i].next < runs[i].end) {
+            heap_insert(heads, &runs[i]);
+        }
+    }
+
+    // Select by score first, even when we're going to display alphabetically,
+    // so that which matches make the cut doesn't depend on how the candidates
+    // happened to be divided up among the workers.
+    unsigned match_count = 0;
+    while (heads->count && match_count < matcher->limit) {
+        run_t *run = HEAP_PEEK(heads);
+        haystack_t *haystack = *run->next;
+        if (haystack->score <= 0.0f) {
+            // Non-matches sort after the matches, so we're done.
+            break;
+        }
+        results->matches[match_count++] = haystack->candidate;
+        (void)heap_extract(heads);
+        if (++run->next < run->end) {
+            heap_insert(heads, run);
+        }
+    }
+    heap_free(heads);
+
+    size_t needle_length = matcher->needle_length;
+    if (needle_length == 0 || (needle_length == 1 && matcher->needle[0] == '.')) {
+        // Alphabetic order if search string is only "" or "."
+        qsort(results->matches, match_count, sizeof(str_t *), cmp_str_p);
+    }
+
+    results->match_count = match_count;
+}
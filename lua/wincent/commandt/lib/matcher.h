@@ -7,17 +7,45 @@
 #define MATCHER_H
 
 #include <stdbool.h> /* for bool */
+#include <stdint.h> /* for uint64_t */
 
 #include "commandt.h" /* for matcher_t */
 #include "str.h" /* for str_t */
 
-// TODO: may later want to return highlight positions as well
 typedef struct {
     str_t **matches;
     unsigned match_count;
     unsigned candidate_count;
+
+    /**
+     * When the matcher's `record_positions` is set, the offsets (in bytes) of
+     * the characters that matched the needle, `position_count` of them per
+     * match: those for `matches[i]` start at `positions[i * position_count]`.
+     * If the positions for a match can't be worked out, they are all
+     * `UINT_MAX`.
+     *
+     * Otherwise (and for provisional results, and when the needle is empty),
+     * `NULL`.
+     */
+    unsigned *positions;
+    unsigned position_count;
+
+    /**
+     * `true` if the run was abandoned because of a call to
+     * `commandt_matcher_cancel()`, in which case `match_count` is 0.
+     */
+    bool cancelled;
 } result_t;
 
+/**
+ * Callback used to report provisional results during a streaming run (see
+ * `commandt_matcher_run_streaming()`).
+ *
+ * The `result` is owned by the matcher and is only valid for the duration of
+ * the call.
+ */
+typedef void (*matcher_progress)(result_t *result, void *context);
+
 /**
  * Returns a new matcher.
  *
@@ -27,8 +55,16 @@ typedef struct {
 matcher_t *commandt_matcher_new(
     scanner_t *scanner,
     bool always_show_dot_files,
+
+    // Whether to keep a lowercase copy of the candidates, which speeds up
+    // case-insensitive matching at the cost of memory (see `scanner_fold()`).
+    bool fold_candidates,
     bool ignore_case,
     bool ignore_spaces,
+
+    // Whether to index big scanners, which speeds up matching at the cost of
+    // memory and of some work in the background (see `scanner_index()`).
+    bool index_candidates,
     unsigned limit,
     bool never_show_dot_files,
     bool smart_case,
@@ -49,9 +85,53 @@ void commandt_matcher_free(matcher_t *matcher);
 /**
  * It is the responsibility of the caller to free the results struct by calling
  * `commandt_result_free()`.
+ *
+ * If the scanner is still being populated (see `scanner_new_exec()`), this
+ * searches the candidates that have arrived so far (waiting for the first one,
+ * if need be), and later runs pick up the rest as they come in.
  */
 result_t *commandt_matcher_run(matcher_t *matcher, const char *needle);
 
+/**
+ * Like `commandt_matcher_run()`, but tags the run with `generation` so that it
+ * can be cancelled from another thread by a call to `commandt_matcher_cancel()`
+ * with a higher generation number.
+ *
+ * A run whose generation is already lower than the matcher's at the time of the
+ * call is cancelled immediately.
+ */
+result_t *commandt_matcher_run_generation(
+    matcher_t *matcher,
+    const char *needle,
+    uint64_t generation
+);
+
+/**
+ * Like `commandt_matcher_run_generation()`, but while the run is in progress,
+ * roughly every `interval` candidates, calls `progress` with a provisional
+ * result drawn from the matches found so far.
+ *
+ * `progress` is always called on the calling thread. The returned (final)
+ * result is identical to the one a non-streaming run would produce.
+ */
+result_t *commandt_matcher_run_streaming(
+    matcher_t *matcher,
+    const char *needle,
+    uint64_t generation,
+    unsigned interval,
+    matcher_progress progress,
+    void *context
+);
+
+/**
+ * Advances the matcher's generation to `generation` (if it is not already at
+ * least that high), causing any in-flight run with a lower generation to stop
+ * at the next chunk boundary and return a `cancelled` result.
+ *
+ * Safe to call from any thread.
+ */
+void commandt_matcher_cancel(matcher_t *matcher, uint64_t generation);
+
 void commandt_result_free(result_t *results);
 
 // TODO: figure out whether I can safely drop the `commandt_` prefixes to these
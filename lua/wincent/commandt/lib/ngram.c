@@ -0,0 +1,379 @@
+/**
+ * SPDX-FileCopyrightText: Copyright 2026-present Greg Hurrell and contributors.
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include "ngram.h"
+
+#include <stdint.h> /* for uint64_t */
+#include <stdlib.h> /* for free(), qsort(), NULL */
+#include <string.h> /* for memcpy(), memset() */
+
+#include "score.h" /* for commandt_bitmask() */
+#include "xmalloc.h" /* for xcalloc(), xmalloc() */
+
+// One character class per bit in a `commandt_bitmask()`.
+#define CLASS_COUNT 64
+#define PAIR_COUNT (CLASS_COUNT * CLASS_COUNT)
+
+// Pairs found in more than 1 in `SELECTIVITY` candidates aren't worth indexing.
+#define SELECTIVITY 8
+
+// Upper bound on the total length of the posting lists, expressed as a number
+// of entries per candidate.
+#define BUDGET 8
+
+// Pair frequencies are estimated from every `SAMPLE_STRIDE`-th candidate.
+#define SAMPLE_STRIDE 8
+
+struct ngram_index_t {
+    /**
+     * For each pair `(x, y)`, at index `x * CLASS_COUNT + y`, whether it has a
+     * posting list.
+     */
+    bool indexed[PAIR_COUNT];
+
+    /**
+     * The posting list for pair `p` is `postings[offsets[p]]` up to (but not
+     * including) `postings[offsets[p + 1]]`.
+     */
+    unsigned offsets[PAIR_COUNT + 1];
+
+    unsigned *postings;
+};
+
+typedef struct {
+    scanner_t *scanner;
+    unsigned worker_count;
+
+    // Maps each byte to its class.
+    unsigned char classes[256];
+
+    // Look at every `stride`-th candidate.
+    unsigned stride;
+
+    // For each class `y`, the classes `x` for which the pair `(x, y)` is
+    // indexed; `NULL` to consider all pairs.
+    const uint64_t *indexed_rows;
+
+    // `PAIR_COUNT` entries per worker: while counting, the number of
+    // candidates containing each pair; while filling, the position in
+    // `postings` at which to write the next one.
+    unsigned *counts;
+
+    // `NULL` while counting.
+    unsigned *postings;
+} build_args_t;
+
+typedef struct {
+    unsigned pair;
+    size_t count;
+} pair_count_t;
+
+typedef struct {
+    const unsigned *start;
+    unsigned length;
+} posting_list_t;
+
+// Forward declarations.
+static void *build(void *build_args, unsigned worker_index);
+static int cmp_count(const void *a, const void *b);
+static int cmp_length(const void *a, const void *b);
+static const unsigned *seek(
+    const unsigned *start,
+    const unsigned *end,
+    unsigned value
+);
+static void select_pairs(
+    ngram_index_t *index,
+    pair_count_t *totals,
+    unsigned total_count,
+    size_t budget,
+    uint64_t *indexed_rows
+);
+
+ngram_index_t *ngram_index_new(scanner_t *scanner, pool_t *pool) {
+    ngram_index_t *index = xcalloc(1, sizeof(ngram_index_t));
+    unsigned worker_count = pool ? pool->count + 1 : 1;
+    build_args_t build_args = {
+        .scanner = scanner,
+        .worker_count = worker_count,
+        .stride = SAMPLE_STRIDE,
+        .indexed_rows = NULL,
+        .counts = xcalloc((size_t)worker_count * PAIR_COUNT, sizeof(unsigned)),
+        .postings = NULL,
+    };
+    for (unsigned c = 0; c < 256; c++) {
+        char byte = (char)c;
+        build_args.classes[c] = __builtin_ctzll(commandt_bitmask(&byte, 1));
+    }
+    void *results[worker_count];
+
+    // First pass: estimate pair frequencies from a sample.
+    if (worker_count == 1) {
+        build(&build_args, 0);
+    } else {
+        pool_run(pool, worker_count, build, &build_args, results);
+    }
+
+    // Pick the rarest pairs, as many as will (probably) fit in the budget.
+    pair_count_t *totals = xmalloc(PAIR_COUNT * sizeof(pair_count_t));
+    unsigned total_count = 0;
+    for (unsigned p = 0; p < PAIR_COUNT; p++) {
+        size_t count = 0;
+        for (unsigned w = 0; w < worker_count; w++) {
+            count += build_args.counts[w * PAIR_COUNT + p];
+        }
+        count *= SAMPLE_STRIDE;
+        if (count <= scanner->count / SELECTIVITY) {
+            totals[total_count].pair = p;
+            totals[total_count].count = count;
+            total_count++;
+        }
+    }
+    size_t budget = (size_t)scanner->count * BUDGET;
+    uint64_t indexed_rows[CLASS_COUNT];
+    select_pairs(index, totals, total_count, budget, indexed_rows);
+
+    // Second pass: count the indexed pairs exactly.
+    build_args.stride = 1;
+    build_args.indexed_rows = indexed_rows;
+    size_t counts_size = (size_t)worker_count * PAIR_COUNT * sizeof(unsigned);
+    memset(build_args.counts, 0, counts_size);
+    if (worker_count == 1) {
+        build(&build_args, 0);
+    } else {
+        pool_run(pool, worker_count, build, &build_args, results);
+    }
+
+    // The sample can be way off (a pair it missed altogether looks free), so
+    // choose again using the exact counts, so that the budget really holds.
+    total_count = 0;
+    for (unsigned p = 0; p < PAIR_COUNT; p++) {
+        if (!index->indexed[p]) {
+            continue;
+        }
+        size_t count = 0;
+        for (unsigned w = 0; w < worker_count; w++) {
+            count += build_args.counts[w * PAIR_COUNT + p];
+        }
+        if (count <= scanner->count / SELECTIVITY) {
+            totals[total_count].pair = p;
+            totals[total_count].count = count;
+            total_count++;
+        } else {
+            index->indexed[p] = false;
+        }
+    }
+    select_pairs(index, totals, total_count, budget, indexed_rows);
+    free(totals);
+
+    // Lay out the posting lists, and turn the counts into write cursors, with
+    // each worker getting a slice of each list (in candidate order, because
+    // each worker handles a contiguous range of candidates).
+    unsigned offset = 0;
+    for (unsigned p = 0; p < PAIR_COUNT; p++) {
+        index->offsets[p] = offset;
+        if (index->indexed[p]) {
+            for (unsigned w = 0; w < worker_count; w++) {
+                unsigned count = build_args.counts[w * PAIR_COUNT + p];
+                build_args.counts[w * PAIR_COUNT + p] = offset;
+                offset += count;
+            }
+        }
+    }
+    index->offsets[PAIR_COUNT] = offset;
+    index->postings = xmalloc((offset ? offset : 1) * sizeof(unsigned));
+
+    // Third pass: fill.
+    build_args.postings = index->postings;
+    if (worker_count == 1) {
+        build(&build_args, 0);
+    } else {
+        pool_run(pool, worker_count, build, &build_args, results);
+    }
+
+    free(build_args.counts);
+    return index;
+}
+
+void ngram_index_free(ngram_index_t *index) {
+    free(index->postings);
+    free(index);
+}
+
+unsigned *ngram_index_lookup(
+    ngram_index_t *index,
+    const char *needle,
+    size_t needle_length,
+    unsigned *count
+) {
+    if (needle_length < 2) {
+        return NULL;
+    }
+
+    posting_list_t lists[needle_length - 1];
+    unsigned list_count = 0;
+    unsigned previous = __builtin_ctzll(commandt_bitmask(needle, 1));
+    for (size_t i = 1; i < needle_length; i++) {
+        unsigned current = __builtin_ctzll(commandt_bitmask(needle + i, 1));
+        unsigned pair = previous * CLASS_COUNT + current;
+        if (index->indexed[pair]) {
+            lists[list_count].start = index->postings + index->offsets[pair];
+            lists[list_count].length =
+                index->offsets[pair + 1] - index->offsets[pair];
+            list_count++;
+        }
+        previous = current;
+    }
+    if (!list_count) {
+        return NULL;
+    }
+
+    // Intersect, starting with the shortest list.
+    qsort(lists, list_count, sizeof(posting_list_t), cmp_length);
+    unsigned length = lists[0].length;
+    unsigned *result = xmalloc((length ? length : 1) * sizeof(unsigned));
+    memcpy(result, lists[0].start, length * sizeof(unsigned));
+    for (unsigned i = 1; i < list_count && length; i++) {
+        const unsigned *next = lists[i].start;
+        const unsigned *end = next + lists[i].length;
+        unsigned kept = 0;
+        for (unsigned j = 0; j < length; j++) {
+            next = seek(next, end, result[j]);
+            if (next == end) {
+                break;
+            }
+            if (*next == result[j]) {
+                result[kept++] = result[j];
+            }
+        }
+        length = kept;
+    }
+
+    *count = length;
+    return result;
+}
+
+static void *build(void *build_args, unsigned worker_index) {
+    build_args_t *args = build_args;
+    scanner_t *scanner = args->scanner;
+    unsigned start = (uint64_t)scanner->count * worker_index /
+        args->worker_count;
+    unsigned end = (uint64_t)scanner->count * (worker_index + 1) /
+        args->worker_count;
+    unsigned stride = args->stride;
+    const uint64_t *indexed_rows = args->indexed_rows;
+    unsigned *counts = args->counts + worker_index * PAIR_COUNT;
+    unsigned *postings = args->postings;
+
+    // `rows[y]` has bit `x` set if class `x` appears before class `y`.
+    uint64_t rows[CLASS_COUNT] = {0};
+
+    for (unsigned i = start; i < end; i += stride) {
+        const char *contents = scanner->candidates[i].contents;
+        size_t length = scanner->candidates[i].length;
+        uint64_t seen = 0;
+        for (size_t j = 0; j < length; j++) {
+            unsigned char c = args->classes[(unsigned char)contents[j]];
+            rows[c] |= seen;
+            seen |= (uint64_t)1 << c;
+        }
+
+        while (seen) {
+            unsigned y = __builtin_ctzll(seen);
+            seen &= seen - 1;
+            uint64_t xs = indexed_rows ? rows[y] & indexed_rows[y] : rows[y];
+            rows[y] = 0;
+            while (xs) {
+                unsigned x = __builtin_ctzll(xs);
+                xs &= xs - 1;
+                unsigned pair = x * CLASS_COUNT + y;
+                if (postings) {
+                    postings[counts[pair]++] = i;
+                } else {
+                    counts[pair]++;
+                }
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Comparison function for use with `qsort()`.
+ */
+static int cmp_count(const void *a, const void *b) {
+    size_t a_count = ((pair_count_t *)a)->count;
+    size_t b_count = ((pair_count_t *)b)->count;
+    return a_count < b_count ? -1 : a_count > b_count ? 1 : 0;
+}
+
+/**
+ * Comparison function for use with `qsort()`.
+ */
+static int cmp_length(const void *a, const void *b) {
+    unsigned a_length = ((posting_list_t *)a)->length;
+    unsigned b_length = ((posting_list_t *)b)->length;
+    return a_length < b_length ? -1 : a_length > b_length ? 1 : 0;
+}
+
+/**
+ * Returns a pointer to the first entry in the sorted range from `start` up to
+ * `end` that is not less than `value`, or `end` if there isn't one.
+ *
+ * Gallops forward from `start` before doing a binary search, because when
+ * intersecting a short list with a long one, consecutive lookups tend to land
+ * close together.
+ */
+static const unsigned *seek(
+    const unsigned *start,
+    const unsigned *end,
+    unsigned value
+) {
+    size_t step = 1;
+    const unsigned *low = start;
+    const unsigned *high = start;
+    while (high < end && *high < value) {
+        low = high + 1;
+        high = (size_t)(end - high) > step ? high + step : end;
+        step *= 2;
+    }
+    while (low < high) {
+        const unsigned *middle = low + (high - low) / 2;
+        if (*middle < value) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+/**
+ * Sorts the `total_count` entries of `totals` and marks as many of the pairs
+ * as will fit in `budget` posting list entries (rarest first) as indexed in
+ * `index`, and the rest as not indexed. `indexed_rows` (with `CLASS_COUNT`
+ * entries) gets the indexed pairs in the form `build()` expects.
+ */
+static void select_pairs(
+    ngram_index_t *index,
+    pair_count_t *totals,
+    unsigned total_count,
+    size_t budget,
+    uint64_t *indexed_rows
+) {
+    qsort(totals, total_count, sizeof(pair_count_t), cmp_count);
+    memset(indexed_rows, 0, CLASS_COUNT * sizeof(uint64_t));
+    size_t used = 0;
+    for (unsigned i = 0; i < total_count; i++) {
+        unsigned pair = totals[i].pair;
+        used += totals[i].count;
+        index->indexed[pair] = used <= budget;
+        if (index->indexed[pair]) {
+            indexed_rows[pair % CLASS_COUNT] |= (uint64_t)1
+                << (pair / CLASS_COUNT);
+        }
+    }
+}
@@ -0,0 +1,65 @@
+/**
+ * SPDX-FileCopyrightText: Copyright 2026-present Greg Hurrell and contributors.
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/**
+ * @file
+ *
+ * An inverted index from character pairs to the candidates containing them,
+ * used to avoid looking at every candidate in very large scanners.
+ *
+ * Because the matcher looks for the needle as a subsequence (not a substring)
+ * of each candidate, the index is keyed by ordered pairs: a candidate is listed
+ * under the pair (x, y) if it contains an x anywhere before a y. Characters are
+ * grouped into the same classes as `commandt_bitmask()` uses. Any candidate
+ * that matches a needle must then be listed under each pair of adjacent needle
+ * characters.
+ *
+ * Only pairs that are rare enough to be worth intersecting get posting lists;
+ * needles made up entirely of common pairs fall back to a linear scan.
+ */
+
+#ifndef NGRAM_H
+#define NGRAM_H
+
+// Define short names for convenience, but all external symbols need prefixes.
+#define ngram_index_free commandt_ngram_index_free
+#define ngram_index_lookup commandt_ngram_index_lookup
+#define ngram_index_new commandt_ngram_index_new
+
+#include <stdbool.h> /* for bool */
+#include <stddef.h> /* for size_t */
+
+#include "commandt.h" /* for scanner_t */
+#include "pool.h" /* for pool_t */
+
+typedef struct ngram_index_t ngram_index_t;
+
+/**
+ * Builds an index of the candidates in `scanner`, using the threads in `pool`
+ * (which may be `NULL`) as well as the calling thread.
+ *
+ * The caller should dispose of the returned index with a call to
+ * `ngram_index_free()`.
+ */
+ngram_index_t *ngram_index_new(scanner_t *scanner, pool_t *pool);
+
+void ngram_index_free(ngram_index_t *index);
+
+/**
+ * Returns the (ascending) indices of the only candidates that could possibly
+ * match `needle`, storing the number of them in `count`.
+ *
+ * Returns `NULL` if the index can't narrow things down (ie. none of the pairs
+ * in the needle are indexed), in which case the caller should look at all of
+ * the candidates. Otherwise, the caller should `free()` the returned array.
+ */
+unsigned *ngram_index_lookup(
+    ngram_index_t *index,
+    const char *needle,
+    size_t needle_length,
+    unsigned *count
+);
+
+#endif
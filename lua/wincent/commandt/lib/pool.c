@@ -0,0 +1,143 @@
+/**
+ * SPDX-FileCopyrightText: Copyright 2026-present Greg Hurrell and contributors.
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include "pool.h"
+
+#include <assert.h> /* for assert() */
+#include <pthread.h> /* for pthread_cond_wait(), pthread_create() etc */
+#include <stdlib.h> /* for free(), NULL */
+
+#include "die.h" /* for die() */
+#include "xmalloc.h" /* for xmalloc() */
+
+// Forward declarations.
+static void *pool_worker(void *worker);
+
+pool_t *pool_new(unsigned count) {
+    pool_t *pool = xmalloc(sizeof(pool_t));
+    pool->count = count;
+    pool->threads = xmalloc(count * sizeof(pthread_t));
+    pool->workers = xmalloc(count * sizeof(pool_worker_t));
+    pool->generation = 0;
+    pool->pending = 0;
+    pool->shutdown = false;
+    pool->task = NULL;
+    pool->context = NULL;
+    pool->results = NULL;
+    pool->task_count = 0;
+
+    int err = pthread_mutex_init(&pool->mutex, NULL);
+    if (err != 0) {
+        die("pthread_mutex_init() failed", err);
+    }
+    err = pthread_cond_init(&pool->wake, NULL);
+    if (err != 0) {
+        die("pthread_cond_init() failed", err);
+    }
+    err = pthread_cond_init(&pool->done, NULL);
+    if (err != 0) {
+        die("pthread_cond_init() failed", err);
+    }
+
+    for (unsigned i = 0; i < count; i++) {
+        pool->workers[i].pool = pool;
+        pool->workers[i].index = i;
+        err = pthread_create(
+            &pool->threads[i], NULL, pool_worker, (void *)&pool->workers[i]
+        );
+        if (err != 0) {
+            die("pthread_create() failed", err);
+        }
+    }
+
+    return pool;
+}
+
+void pool_free(pool_t *pool) {
+    pthread_mutex_lock(&pool->mutex);
+    pool->shutdown = true;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for (unsigned i = 0; i < pool->count; i++) {
+        int err = pthread_join(pool->threads[i], NULL);
+        if (err != 0) {
+            die("pthread_join() failed", err);
+        }
+    }
+
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->wake);
+    pthread_mutex_destroy(&pool->mutex);
+    free(pool->workers);
+    free(pool->threads);
+    free(pool);
+}
+
+void pool_run(
+    pool_t *pool,
+    unsigned count,
+    pool_task task,
+    void *context,
+    void **results
+) {
+    assert(count > 0);
+    assert(count <= pool->count + 1);
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->task = task;
+    pool->context = context;
+    pool->results = results;
+    pool->task_count = count - 1;
+    pool->pending = count - 1;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->mutex);
+
+    // For the last worker, we'll just use the calling thread.
+    results[count - 1] = task(context, count - 1);
+
+    pthread_mutex_lock(&pool->mutex);
+    while (pool->pending) {
+        pthread_cond_wait(&pool->done, &pool->mutex);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+static void *pool_worker(void *worker) {
+    pool_t *pool = ((pool_worker_t *)worker)->pool;
+    unsigned index = ((pool_worker_t *)worker)->index;
+    unsigned long generation = 0;
+
+    pthread_mutex_lock(&pool->mutex);
+    while (true) {
+        while (pool->generation == generation && !pool->shutdown) {
+            pthread_cond_wait(&pool->wake, &pool->mutex);
+        }
+        if (pool->shutdown) {
+            break;
+        }
+        generation = pool->generation;
+
+        // Jobs that need fewer workers than the pool has leave the surplus
+        // threads parked.
+        if (index < pool->task_count) {
+            pool_task task = pool->task;
+            void *context = pool->context;
+            pthread_mutex_unlock(&pool->mutex);
+
+            void *result = task(context, index);
+
+            pthread_mutex_lock(&pool->mutex);
+            pool->results[index] = result;
+            if (--pool->pending == 0) {
+                pthread_cond_signal(&pool->done);
+            }
+        }
+    }
+    pthread_mutex_unlock(&pool->mutex);
+
+    return NULL;
+}
@@ -0,0 +1,111 @@
+/**
+ * SPDX-FileCopyrightText: Copyright 2026-present Greg Hurrell and contributors.
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/**
+ * @file
+ *
+ * A fixed size pool of long-lived worker threads.
+ *
+ * Threads are created once, up-front, and park on a condition variable between
+ * jobs, so that dispatching work to them costs a wake-up rather than a
+ * `pthread_create()`/`pthread_join()` round-trip.
+ */
+
+#ifndef POOL_H
+#define POOL_H
+
+// Define short names for convenience, but all external symbols need prefixes.
+#define pool_free commandt_pool_free
+#define pool_new commandt_pool_new
+#define pool_run commandt_pool_run
+
+#include <pthread.h> /* for pthread_cond_t, pthread_mutex_t, pthread_t */
+#include <stdbool.h> /* for bool */
+
+/**
+ * Signature for tasks run by the pool. `context` is shared by all workers, and
+ * `index` identifies the worker (from 0 up to, but not including, the `count`
+ * passed to `pool_run()`).
+ */
+typedef void *(*pool_task)(void *context, unsigned index);
+
+typedef struct pool_t pool_t;
+
+typedef struct {
+    pool_t *pool;
+    unsigned index;
+} pool_worker_t;
+
+struct pool_t {
+    /**
+     * Number of background threads in the pool.
+     */
+    unsigned count;
+
+    pthread_t *threads;
+    pool_worker_t *workers;
+
+    pthread_mutex_t mutex;
+
+    /**
+     * Signalled (broadcast) when a new job is published, or on shutdown.
+     */
+    pthread_cond_t wake;
+
+    /**
+     * Signalled when the last busy background thread finishes its task.
+     */
+    pthread_cond_t done;
+
+    /**
+     * Incremented each time a job is published; workers compare this against
+     * the last value they saw to detect new work (and to ignore spurious
+     * wake-ups).
+     */
+    unsigned long generation;
+
+    /**
+     * Number of background threads that have yet to finish the current job.
+     */
+    unsigned pending;
+
+    bool shutdown;
+
+    // Details of the current job.
+    pool_task task;
+    void *context;
+    void **results;
+    unsigned task_count;
+};
+
+/**
+ * Returns a new pool with `count` background threads.
+ *
+ * The caller should dispose of the returned pool with a call to `pool_free()`.
+ */
+pool_t *pool_new(unsigned count);
+
+/**
+ * Wakes and joins the pool's threads, then frees the pool.
+ */
+void pool_free(pool_t *pool);
+
+/**
+ * Runs `task` `count` times, once per worker index, storing the value returned
+ * for each index in the corresponding slot of `results`.
+ *
+ * The calling thread runs the task for the last index itself, so `count` may be
+ * at most one more than the number of background threads in the pool. Blocks
+ * until all tasks have finished.
+ */
+void pool_run(
+    pool_t *pool,
+    unsigned count,
+    pool_task task,
+    void *context,
+    void **results
+);
+
+#endif
@@ -0,0 +1,233 @@
+/**
+ * SPDX-FileCopyrightText: Copyright 2026-present Greg Hurrell and contributors.
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include "prefilter.h"
+
+#include <stdatomic.h> /* for atomic_load_explicit(), atomic_store_explicit() */
+#include <stddef.h> /* for NULL */
+
+#if defined(__x86_64__)
+#define PREFILTER_X86
+#include <immintrin.h> /* for _mm256_andnot_si256(), _mm_cmpeq_epi64() etc */
+#elif defined(__aarch64__)
+#define PREFILTER_NEON
+#include <arm_neon.h> /* for vbicq_u64(), vceqzq_u64() etc */
+#endif
+
+typedef unsigned (*prefilter_impl)(
+    const uint64_t *bitmasks,
+    const unsigned *indices,
+    unsigned start,
+    unsigned count,
+    uint64_t needle_bitmask,
+    unsigned *out
+);
+
+static _Atomic(prefilter_impl) selected = NULL;
+
+// Forward declarations.
+static unsigned prefilter_scalar(
+    const uint64_t *bitmasks,
+    const unsigned *indices,
+    unsigned start,
+    unsigned count,
+    uint64_t needle_bitmask,
+    unsigned *out
+);
+static prefilter_impl select_impl(void);
+
+unsigned prefilter(
+    const uint64_t *bitmasks,
+    const unsigned *indices,
+    unsigned start,
+    unsigned count,
+    uint64_t needle_bitmask,
+    unsigned *out
+) {
+    prefilter_impl impl =
+        atomic_load_explicit(&selected, memory_order_relaxed);
+    if (!impl) {
+        // Racing threads all pick the same implementation, so it doesn't
+        // matter which of them gets to store it.
+        impl = select_impl();
+        atomic_store_explicit(&selected, impl, memory_order_relaxed);
+    }
+    return impl(bitmasks, indices, start, count, needle_bitmask, out);
+}
+
+// Note that all of the implementations below write to `out` unconditionally and
+// then only advance if the candidate passes, which avoids a hard-to-predict
+// branch per candidate.
+
+static unsigned prefilter_scalar(
+    const uint64_t *bitmasks,
+    const unsigned *indices,
+    unsigned start,
+    unsigned count,
+    uint64_t needle_bitmask,
+    unsigned *out
+) {
+    unsigned end = start + count;
+    unsigned n = 0;
+    for (unsigned i = start; i < end; i++) {
+        unsigned index = indices ? indices[i] : i;
+        out[n] = index;
+        n += (bitmasks[index] & needle_bitmask) == needle_bitmask;
+    }
+    return n;
+}
+
+#ifdef PREFILTER_X86
+
+__attribute__((target("avx2"))) static unsigned prefilter_avx2(
+    const uint64_t *bitmasks,
+    const unsigned *indices,
+    unsigned start,
+    unsigned count,
+    uint64_t needle_bitmask,
+    unsigned *out
+) {
+    __m256i needle = _mm256_set1_epi64x((long long)needle_bitmask);
+    __m256i zero = _mm256_setzero_si256();
+    unsigned end = start + count;
+    unsigned n = 0;
+    unsigned i = start;
+    for (; i + 4 <= end; i += 4) {
+        __m128i lanes;
+        __m256i masks;
+        if (indices) {
+            lanes = _mm_loadu_si128((const __m128i *)(indices + i));
+            masks = _mm256_i32gather_epi64(
+                (const long long *)bitmasks, lanes, sizeof(uint64_t)
+            );
+        } else {
+            lanes = _mm_add_epi32(
+                _mm_set1_epi32((int)i), _mm_setr_epi32(0, 1, 2, 3)
+            );
+            masks = _mm256_loadu_si256((const __m256i *)(bitmasks + i));
+        }
+
+        // A lane passes when no needle bits are missing from its mask.
+        __m256i missing = _mm256_andnot_si256(masks, needle);
+        int pass = _mm256_movemask_pd(
+            _mm256_castsi256_pd(_mm256_cmpeq_epi64(missing, zero))
+        );
+
+        unsigned index[4];
+        _mm_storeu_si128((__m128i *)index, lanes);
+        for (unsigned j = 0; j < 4; j++) {
+            out[n] = index[j];
+            n += (pass >> j) & 1;
+        }
+    }
+    return n + prefilter_scalar(
+                   bitmasks, indices, i, end - i, needle_bitmask, out + n
+               );
+}
+
+__attribute__((target("sse4.1"))) static unsigned prefilter_sse41(
+    const uint64_t *bitmasks,
+    const unsigned *indices,
+    unsigned start,
+    unsigned count,
+    uint64_t needle_bitmask,
+    unsigned *out
+) {
+    __m128i needle = _mm_set1_epi64x((long long)needle_bitmask);
+    __m128i zero = _mm_setzero_si128();
+    unsigned end = start + count;
+    unsigned n = 0;
+    unsigned i = start;
+    for (; i + 2 <= end; i += 2) {
+        unsigned index[2];
+        __m128i masks;
+        if (indices) {
+            index[0] = indices[i];
+            index[1] = indices[i + 1];
+            masks = _mm_set_epi64x(
+                (long long)bitmasks[index[1]], (long long)bitmasks[index[0]]
+            );
+        } else {
+            index[0] = i;
+            index[1] = i + 1;
+            masks = _mm_loadu_si128((const __m128i *)(bitmasks + i));
+        }
+
+        __m128i missing = _mm_andnot_si128(masks, needle);
+        int pass = _mm_movemask_pd(
+            _mm_castsi128_pd(_mm_cmpeq_epi64(missing, zero))
+        );
+
+        out[n] = index[0];
+        n += pass & 1;
+        out[n] = index[1];
+        n += (pass >> 1) & 1;
+    }
+    return n + prefilter_scalar(
+                   bitmasks, indices, i, end - i, needle_bitmask, out + n
+               );
+}
+
+#endif
+
+#ifdef PREFILTER_NEON
+
+static unsigned prefilter_neon(
+    const uint64_t *bitmasks,
+    const unsigned *indices,
+    unsigned start,
+    unsigned count,
+    uint64_t needle_bitmask,
+    unsigned *out
+) {
+    uint64x2_t needle = vdupq_n_u64(needle_bitmask);
+    unsigned end = start + count;
+    unsigned n = 0;
+    unsigned i = start;
+    for (; i + 2 <= end; i += 2) {
+        unsigned index[2];
+        uint64x2_t masks;
+        if (indices) {
+            index[0] = indices[i];
+            index[1] = indices[i + 1];
+            masks = vcombine_u64(
+                vcreate_u64(bitmasks[index[0]]),
+                vcreate_u64(bitmasks[index[1]])
+            );
+        } else {
+            index[0] = i;
+            index[1] = i + 1;
+            masks = vld1q_u64(bitmasks + i);
+        }
+
+        // Lanes are all ones where no needle bits are missing from the mask.
+        uint64x2_t pass = vceqzq_u64(vbicq_u64(needle, masks));
+
+        out[n] = index[0];
+        n += vgetq_lane_u64(pass, 0) & 1;
+        out[n] = index[1];
+        n += vgetq_lane_u64(pass, 1) & 1;
+    }
+    return n + prefilter_scalar(
+                   bitmasks, indices, i, end - i, needle_bitmask, out + n
+               );
+}
+
+#endif
+
+static prefilter_impl select_impl(void) {
+#if defined(PREFILTER_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return prefilter_avx2;
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+        return prefilter_sse41;
+    }
+#elif defined(PREFILTER_NEON)
+    return prefilter_neon;
+#endif
+    return prefilter_scalar;
+}
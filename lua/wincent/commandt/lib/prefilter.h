@@ -0,0 +1,44 @@
+/**
+ * SPDX-FileCopyrightText: Copyright 2026-present Greg Hurrell and contributors.
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/**
+ * @file
+ *
+ * Vectorized bitmask prefilter, used to throw out candidates that can't
+ * possibly match before any of them get scored.
+ *
+ * The implementation (AVX2, SSE4.1, NEON or plain C) is chosen at runtime, on
+ * first use, based on what the CPU supports.
+ */
+
+#ifndef PREFILTER_H
+#define PREFILTER_H
+
+// Define short names for convenience, but all external symbols need prefixes.
+#define prefilter commandt_prefilter
+
+#include <stdint.h> /* for uint64_t */
+
+/**
+ * Looks at the `count` candidates starting at `start` (or, if `indices` is
+ * non-NULL, those listed in `indices[start]` up to `indices[start + count]`),
+ * and writes the indices of those whose entry in `bitmasks` contains all of the
+ * bits in `needle_bitmask` into `out`, in order.
+ *
+ * Candidates with an unset bitmask (all bits set) always pass.
+ *
+ * Returns the number of indices written to `out`, which must have room for
+ * `count` entries.
+ */
+unsigned prefilter(
+    const uint64_t *bitmasks,
+    const unsigned *indices,
+    unsigned start,
+    unsigned count,
+    uint64_t needle_bitmask,
+    unsigned *out
+);
+
+#endif
@@ -0,0 +1,270 @@
+/**
+ * SPDX-FileCopyrightText: Copyright 2026-present Greg Hurrell and contributors.
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include "prescan.h"
+
+#include <stdatomic.h> /* for atomic_load_explicit(), atomic_store_explicit() */
+#include <stdint.h> /* for uint32_t, uint64_t */
+
+#if defined(__x86_64__)
+#define PRESCAN_X86
+#include <immintrin.h> /* for _mm256_cmpeq_epi8(), _mm_cmpeq_epi8() etc */
+#elif defined(__aarch64__)
+#define PRESCAN_NEON
+#include <arm_neon.h> /* for vceqq_u8(), vshrn_n_u16() etc */
+#endif
+
+typedef bool (*prescan_impl)(
+    const char *haystack,
+    size_t length,
+    const char *needle,
+    size_t needle_length,
+    bool ignore_case,
+    size_t *rightmost
+);
+
+static _Atomic(prescan_impl) selected = NULL;
+
+// Forward declarations.
+static prescan_impl select_impl(void);
+
+bool prescan(
+    const char *haystack,
+    size_t length,
+    const char *needle,
+    size_t needle_length,
+    bool ignore_case,
+    size_t *rightmost
+) {
+    prescan_impl impl = atomic_load_explicit(&selected, memory_order_relaxed);
+    if (!impl) {
+        // Racing threads all pick the same implementation, so it doesn't
+        // matter which of them gets to store it.
+        impl = select_impl();
+        atomic_store_explicit(&selected, impl, memory_order_relaxed);
+    }
+    return impl(
+        haystack, length, needle, needle_length, ignore_case, rightmost
+    );
+}
+
+/**
+ * Scans `haystack[0]` up to (but not including) `haystack[length]` backwards,
+ * looking for `needle[0]` through `needle[needle_idx]`. Used on its own, and
+ * to finish off whatever is left at the start of the haystack after the
+ * vector implementations have consumed as many whole blocks as they can.
+ */
+static bool scan_tail(
+    const char *haystack,
+    size_t length,
+    const char *needle,
+    size_t needle_idx,
+    bool ignore_case,
+    size_t *rightmost
+) {
+    char d = needle[needle_idx];
+    for (size_t i = length; i > 0; i--) {
+        char c = haystack[i - 1];
+        if (ignore_case && c >= 'A' && c <= 'Z') {
+            c |= 0x20;
+        }
+        if (c == d) {
+            rightmost[needle_idx] = i - 1;
+            if (needle_idx == 0) {
+                return true;
+            }
+            d = needle[--needle_idx];
+        }
+    }
+    return false;
+}
+
+// The vector implementations all work the same way: load a block, downcase it
+// if necessary, and then repeatedly compare it against the current needle char,
+// taking the highest matching position below the previous match (if any) in
+// the same block.
+
+#ifdef PRESCAN_X86
+
+static inline unsigned highest_bit(uint32_t bits) {
+    return 31 - __builtin_clz(bits);
+}
+
+static bool prescan_sse2(
+    const char *haystack,
+    size_t length,
+    const char *needle,
+    size_t needle_length,
+    bool ignore_case,
+    size_t *rightmost
+) {
+    size_t needle_idx = needle_length - 1;
+    __m128i before_a = _mm_set1_epi8('A' - 1);
+    __m128i after_z = _mm_set1_epi8('Z' + 1);
+    __m128i case_bit = _mm_set1_epi8(0x20);
+    while (length >= 16) {
+        size_t base = length - 16;
+        __m128i block = _mm_loadu_si128((const __m128i *)(haystack + base));
+        if (ignore_case) {
+            __m128i upper = _mm_and_si128(
+                _mm_cmpgt_epi8(block, before_a), _mm_cmplt_epi8(block, after_z)
+            );
+            block = _mm_or_si128(block, _mm_and_si128(upper, case_bit));
+        }
+        uint32_t limit = 0xffff;
+        while (true) {
+            __m128i d = _mm_set1_epi8(needle[needle_idx]);
+            uint32_t bits =
+                (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(block, d)) & limit;
+            if (!bits) {
+                break;
+            }
+            unsigned position = highest_bit(bits);
+            rightmost[needle_idx] = base + position;
+            if (needle_idx == 0) {
+                return true;
+            }
+            needle_idx--;
+            limit = (1u << position) - 1;
+        }
+        length = base;
+    }
+    return scan_tail(
+        haystack, length, needle, needle_idx, ignore_case, rightmost
+    );
+}
+
+__attribute__((target("avx2"))) static bool prescan_avx2(
+    const char *haystack,
+    size_t length,
+    const char *needle,
+    size_t needle_length,
+    bool ignore_case,
+    size_t *rightmost
+) {
+    size_t needle_idx = needle_length - 1;
+    __m256i before_a = _mm256_set1_epi8('A' - 1);
+    __m256i after_z = _mm256_set1_epi8('Z' + 1);
+    __m256i case_bit = _mm256_set1_epi8(0x20);
+    while (length >= 32) {
+        size_t base = length - 32;
+        __m256i block =
+            _mm256_loadu_si256((const __m256i *)(haystack + base));
+        if (ignore_case) {
+            __m256i upper = _mm256_and_si256(
+                _mm256_cmpgt_epi8(block, before_a),
+                _mm256_cmpgt_epi8(after_z, block)
+            );
+            block = _mm256_or_si256(block, _mm256_and_si256(upper, case_bit));
+        }
+        uint32_t limit = 0xffffffff;
+        while (true) {
+            __m256i d = _mm256_set1_epi8(needle[needle_idx]);
+            uint32_t bits =
+                (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, d)) &
+                limit;
+            if (!bits) {
+                break;
+            }
+            unsigned position = highest_bit(bits);
+            rightmost[needle_idx] = base + position;
+            if (needle_idx == 0) {
+                return true;
+            }
+            needle_idx--;
+            limit = (1u << position) - 1;
+        }
+        length = base;
+    }
+    return scan_tail(
+        haystack, length, needle, needle_idx, ignore_case, rightmost
+    );
+}
+
+#endif
+
+#ifdef PRESCAN_NEON
+
+static bool prescan_neon(
+    const char *haystack,
+    size_t length,
+    const char *needle,
+    size_t needle_length,
+    bool ignore_case,
+    size_t *rightmost
+) {
+    size_t needle_idx = needle_length - 1;
+    uint8x16_t a = vdupq_n_u8('A');
+    uint8x16_t range = vdupq_n_u8('Z' - 'A');
+    uint8x16_t case_bit = vdupq_n_u8(0x20);
+    while (length >= 16) {
+        size_t base = length - 16;
+        uint8x16_t block = vld1q_u8((const uint8_t *)(haystack + base));
+        if (ignore_case) {
+            uint8x16_t upper = vcleq_u8(vsubq_u8(block, a), range);
+            block = vorrq_u8(block, vandq_u8(upper, case_bit));
+        }
+
+        // NEON has no movemask, so narrow each byte of the comparison to a
+        // nibble instead: 4 bits per position in a 64-bit mask.
+        uint64_t limit = ~(uint64_t)0;
+        while (true) {
+            uint8x16_t d = vdupq_n_u8((uint8_t)needle[needle_idx]);
+            uint8x8_t nibbles = vshrn_n_u16(
+                vreinterpretq_u16_u8(vceqq_u8(block, d)), 4
+            );
+            uint64_t bits = vget_lane_u64(vreinterpret_u64_u8(nibbles), 0) &
+                limit;
+            if (!bits) {
+                break;
+            }
+            unsigned position = (63 - __builtin_clzll(bits)) / 4;
+            rightmost[needle_idx] = base + position;
+            if (needle_idx == 0) {
+                return true;
+            }
+            needle_idx--;
+            limit = ((uint64_t)1 << (position * 4)) - 1;
+        }
+        length = base;
+    }
+    return scan_tail(
+        haystack, length, needle, needle_idx, ignore_case, rightmost
+    );
+}
+
+#endif
+
+#if !defined(PRESCAN_X86) && !defined(PRESCAN_NEON)
+
+static bool prescan_scalar(
+    const char *haystack,
+    size_t length,
+    const char *needle,
+    size_t needle_length,
+    bool ignore_case,
+    size_t *rightmost
+) {
+    return scan_tail(
+        haystack, length, needle, needle_length - 1, ignore_case, rightmost
+    );
+}
+
+#endif
+
+static prescan_impl select_impl(void) {
+#if defined(PRESCAN_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return prescan_avx2;
+    }
+    // SSE2 is part of the x86-64 baseline.
+    return prescan_sse2;
+#elif defined(PRESCAN_NEON)
+    return prescan_neon;
+#else
+    return prescan_scalar;
+#endif
+}
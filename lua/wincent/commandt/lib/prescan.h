@@ -0,0 +1,48 @@
+/**
+ * SPDX-FileCopyrightText: Copyright 2026-present Greg Hurrell and contributors.
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/**
+ * @file
+ *
+ * Vectorized pre-scan of a haystack, used by the scorer to find out whether
+ * the needle can match at all, and how far to the right each needle char can
+ * possibly match.
+ *
+ * The implementation (AVX2, SSE2, NEON or plain C) is chosen at runtime, on
+ * first use, based on what the CPU supports.
+ */
+
+#ifndef PRESCAN_H
+#define PRESCAN_H
+
+// Define short names for convenience, but all external symbols need prefixes.
+#define prescan commandt_prescan
+
+#include <stdbool.h> /* for bool */
+#include <stddef.h> /* for size_t */
+
+/**
+ * Walks `haystack` backwards, matching the chars of `needle` (which must be
+ * non-empty) from last to first, and recording the position of each match in
+ * `rightmost`.
+ *
+ * When `ignore_case` is true, uppercase ASCII letters in `haystack` are
+ * downcased before comparison (`needle` is assumed to be downcased already).
+ *
+ * Returns `true` if the whole needle was matched, in which case
+ * `rightmost[i]` is the rightmost position at which `needle[i]` can match with
+ * all of the following needle chars still matching after it. Otherwise, the
+ * contents of `rightmost` are unspecified.
+ */
+bool prescan(
+    const char *haystack,
+    size_t length,
+    const char *needle,
+    size_t needle_length,
+    bool ignore_case,
+    size_t *rightmost
+);
+
+#endif
@@ -3,31 +3,181 @@
  * SPDX-License-Identifier: BSD-2-Clause
  */
 
+// For `F_SETPIPE_SZ` (Linux only).
+#define _GNU_SOURCE
+
 #include "scanner.h"
 
 #include <assert.h> /* for assert() */
-#include <signal.h> /* for SIGKILL, kill() */
+#include <errno.h> /* for EINTR, errno */
+#include <fcntl.h> /* for F_SETFD, F_SETPIPE_SZ, O_WRONLY, fcntl() */
+#include <limits.h> /* for UINT_MAX */
+#include <pthread.h> /* for pthread_create(), pthread_join() etc */
+#include <signal.h> /* for SIGKILL, SIGTERM, kill() */
+#include <spawn.h> /* for posix_spawnp(), posix_spawnattr_init() etc */
+#include <stdatomic.h> /* for atomic_bool, atomic_load(), atomic_store() */
+#include <stdbool.h> /* for bool */
 #include <stddef.h> /* for NULL */
+#include <stdint.h> /* for uint8_t */
 #include <stdio.h> /* for fprintf(), stderr */
 #include <stdlib.h> /* for free() */
-#include <string.h> /* for memchr(), strlen() */
-#include <sys/wait.h> /* for wait() */
-#include <unistd.h> /* _exit(), close(), fork(), pipe(), read() */
+#include <string.h> /* for memcmp(), memcpy(), memmove(), strlen() */
+#include <sys/wait.h> /* for WEXITED, WNOWAIT, waitid(), waitpid() */
+#include <unistd.h> /* for close(), pipe(), read() */
 
+#include "ngram.h" /* for ngram_index_free(), ngram_index_new() */
+#include "pool.h" /* for pool_free(), pool_new() */
+#include "score.h" /* for commandt_score_boundaries() */
+#include "split.h" /* for split() */
 #include "str.h" /* for str_append(), str_new(), str_init(), str_init_copy() */
-#include "xmalloc.h" /* for xcalloc() */
+#include "xmalloc.h" /* for xcalloc(), xmalloc() */
 #include "xmap.h" /* for xmap(), xmunmap() */
+#include "xstrdup.h" /* for xstrdup() */
 
-// TODO: make this capable of producing asynchronously?
+// Only bother indexing scanners with at least this many candidates.
+#define INDEX_THRESHOLD 100000
 
 // Special `candidates_size`/`buffer_size` value to indicate that this scanner
 // does not own its storage, but rather that the caller will be responsible for
 // managing its lifecycle.
 #define UNOWNED (-1)
 
+// Reads start out at `MIN_READ_SIZE` bytes, and double (up to `MAX_READ_SIZE`)
+// each time one fills the space on offer, so that big outputs only take a few
+// system calls.
+#define MIN_READ_SIZE 65536
+#define MAX_READ_SIZE 4194304
+
+// Size we ask for the pipe to be, so that the command can get further ahead of
+// us before it has to wait (on Linux, this is capped by
+// "/proc/sys/fs/pipe-max-size", which is 1 MB by default).
+#define PIPE_SIZE 1048576
+
+// Number of terminators looked for in each call to `split()`.
+#define SPLIT_BATCH 4096
+
+// Not declared in any header on some platforms.
+extern char **environ;
+
 static long MAX_FILES = MAX_FILES_CONF;
 static size_t buffer_size = MMAP_SLAB_SIZE_CONF;
 
+/**
+ * One of the commands populating a scanner, and the thread that reads its
+ * output.
+ */
+typedef struct scanner_source_t {
+    struct scanner_reader_t *reader;
+    pthread_t thread;
+    pid_t child_pid;
+    int fd;
+
+    // Put in front of each of this source's candidates (see
+    // `scanner_new_multi()`); `NULL` if there is nothing to put there.
+    char *prefix;
+    size_t prefix_length;
+
+    // Whether the output is being read on `thread` (as opposed to having been
+    // read on the thread that created the scanner).
+    bool threaded;
+
+    // Set, while holding the reader's `mutex`, once `child_pid` has been
+    // reaped.
+    bool reaped;
+} scanner_source_t;
+
+/**
+ * State shared between a scanner and the threads that populate it with the
+ * output of one or more commands (see `scanner_new_exec()` and
+ * `scanner_new_multi()`).
+ *
+ * The threads only ever append to the scanner's `candidates` and `buffer`, and
+ * leave it up to `scanner_wait()` to update `count`.
+ */
+typedef struct scanner_reader_t {
+    scanner_t *scanner;
+    unsigned drop;
+    unsigned max_files;
+    scanner_terminator_t terminator;
+
+    // Set to ask the threads to stop reading early.
+    atomic_bool stop;
+
+    pthread_mutex_t mutex;
+
+    // Signalled whenever `count` or `done` changes.
+    pthread_cond_t changed;
+
+    // Number of candidates that have been read so far.
+    unsigned count;
+
+    // Number of bytes of the scanner's buffer that have been handed out to
+    // candidates by `add_copies()`.
+    size_t used;
+
+    // Number of sources that haven't finished yet.
+    unsigned running;
+
+    // Set once all of the commands have finished and have been waited on.
+    bool done;
+
+    unsigned source_count;
+    scanner_source_t sources[];
+} scanner_reader_t;
+
+/**
+ * A thread building a scanner's index (see `scanner_index()`).
+ */
+typedef struct scanner_indexer_t {
+    scanner_t *scanner;
+    unsigned threads;
+    pthread_t thread;
+
+    // Set by the thread once it has finished with `index`.
+    atomic_bool done;
+
+    ngram_index_t *index;
+} scanner_indexer_t;
+
+// Forward declarations.
+static bool add_candidate(
+    scanner_reader_t *reader,
+    char *start,
+    char *end,
+    unsigned *count
+);
+static bool add_copies(
+    scanner_source_t *source,
+    char *start,
+    char *scanned,
+    const unsigned *offsets,
+    size_t found
+);
+static void finish_source(scanner_source_t *source);
+static void *build_index(void *scanner_indexer);
+static bool is_root(scanner_reader_t *reader, const char *path, size_t length);
+static scanner_reader_t *new_reader(
+    scanner_t *scanner,
+    unsigned source_count,
+    unsigned drop,
+    unsigned max_files,
+    scanner_terminator_t terminator
+);
+static scanner_t *new_scanner(void);
+static void publish(scanner_reader_t *reader, unsigned count);
+static void *read_candidates(void *source);
+static void *read_copies(void *source);
+static void reader_free(scanner_reader_t *reader);
+static size_t slab_size(scanner_t *scanner);
+static bool spawn(
+    const char *file,
+    char *const argv[],
+    bool quiet,
+    scanner_source_t *source
+);
+static void start(scanner_reader_t *reader);
+static void stop_sources(scanner_reader_t *reader, int signum);
+
 scanner_t *scanner_new_copy(const char **candidates, unsigned count) {
     scanner_t *scanner = xcalloc(1, sizeof(scanner_t));
     scanner->candidates_size = count * sizeof(str_t);
@@ -42,87 +192,604 @@ scanner_t *scanner_new_copy(const char **candidates, unsigned count) {
     return scanner;
 }
 
-scanner_t *scanner_new_exec(const char *command, unsigned drop, unsigned max_files) {
+scanner_t *scanner_new_exec(
+    const char *command,
+    unsigned drop,
+    unsigned max_files,
+    scanner_terminator_t terminator
+) {
+    scanner_t *scanner = new_scanner();
+    scanner_reader_t *reader =
+        new_reader(scanner, 1, drop, max_files, terminator);
+
+    // Run the command via a shell, to mimic the behavior of `popen()`.
+    char *const argv[] = {"sh", "-c", (char *)command, NULL};
+    spawn("/bin/sh", argv, false, &reader->sources[0]);
+    start(reader);
+    return scanner;
+}
+
+scanner_t *scanner_new_argv(
+    const char **argv,
+    unsigned drop,
+    unsigned max_files,
+    scanner_terminator_t terminator
+) {
+    scanner_t *scanner = new_scanner();
+    scanner_reader_t *reader =
+        new_reader(scanner, 1, drop, max_files, terminator);
+    spawn(argv[0], (char *const *)argv, true, &reader->sources[0]);
+    start(reader);
+    return scanner;
+}
+
+scanner_t *scanner_new_multi(
+    unsigned count,
+    const char **argvs,
+    const char **prefixes,
+    unsigned drop,
+    unsigned max_files,
+    scanner_terminator_t terminator
+) {
+    scanner_t *scanner = new_scanner();
+    scanner_reader_t *reader =
+        new_reader(scanner, count, drop, max_files, terminator);
+    const char **argv = argvs;
+    for (unsigned i = 0; i < count; i++) {
+        scanner_source_t *source = &reader->sources[i];
+        if (prefixes[i] && prefixes[i][0]) {
+            source->prefix = xstrdup(prefixes[i]);
+            source->prefix_length = strlen(prefixes[i]);
+        }
+        spawn(argv[0], (char *const *)argv, true, source);
+        while (*argv) {
+            argv++;
+        }
+        argv++;
+    }
+    start(reader);
+    return scanner;
+}
+
+/**
+ * Returns a scanner with room for the output of a command (or commands).
+ */
+static scanner_t *new_scanner(void) {
     scanner_t *scanner = xcalloc(1, sizeof(scanner_t));
     scanner->candidates_size = sizeof(str_t) * MAX_FILES;
     scanner->candidates = xmap(scanner->candidates_size);
     scanner->buffer_size = buffer_size;
     scanner->buffer = xmap(scanner->buffer_size);
+    return scanner;
+}
 
+static scanner_reader_t *new_reader(
+    scanner_t *scanner,
+    unsigned source_count,
+    unsigned drop,
+    unsigned max_files,
+    scanner_terminator_t terminator
+) {
+    scanner_reader_t *reader = xcalloc(
+        1, sizeof(scanner_reader_t) + source_count * sizeof(scanner_source_t)
+    );
+    reader->scanner = scanner;
+    reader->drop = drop;
+    reader->max_files = max_files;
+    reader->terminator = terminator;
+    atomic_init(&reader->stop, false);
+    pthread_mutex_init(&reader->mutex, NULL);
+    pthread_cond_init(&reader->changed, NULL);
+    reader->source_count = source_count;
+    for (unsigned i = 0; i < source_count; i++) {
+        reader->sources[i].reader = reader;
+        reader->sources[i].fd = -1;
+        reader->sources[i].reaped = true;
+    }
+    return reader;
+}
+
+/**
+ * Runs `file` (looked up in the `PATH` if it contains no slash) with `argv`,
+ * setting up `source` to read its standard output, which is the only output
+ * we want from it when `quiet` is true.
+ *
+ * Returns `false` if the command couldn't be started, in which case the
+ * source has nothing to read.
+ */
+static bool spawn(
+    const char *file,
+    char *const argv[],
+    bool quiet,
+    scanner_source_t *source
+) {
     // Index 0 = read end of pipe; index 1 = write end of pipe.
     int stdout_pipe[2];
 
     if (pipe(stdout_pipe) != 0) {
-        goto out;
+        return false;
     }
 
-    pid_t child_pid = fork();
-    if (child_pid == -1) {
-        goto out;
-    } else if (child_pid == 0) {
-        // In child.
-        if (close(stdout_pipe[0]) != 0) {
-            goto bail_child;
+    // Keep both ends out of any other processes that get started while this
+    // one is running (our child only needs the copy it gets as its standard
+    // output), as they would otherwise hold the pipe open and stop us from
+    // seeing the end of the output.
+    fcntl(stdout_pipe[0], F_SETFD, FD_CLOEXEC);
+    fcntl(stdout_pipe[1], F_SETFD, FD_CLOEXEC);
+#ifdef F_SETPIPE_SZ
+    // Failure here is harmless; we'll just make do with the default size.
+    fcntl(stdout_pipe[0], F_SETPIPE_SZ, PIPE_SIZE);
+#endif
+
+    // `posix_spawn()` doesn't copy our address space (or, on Linux, even our
+    // page tables) the way `fork()` does, which adds up when there are
+    // gigabytes of it.
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, stdout_pipe[1], 1);
+    if (quiet) {
+        posix_spawn_file_actions_addopen(&actions, 2, "/dev/null", O_WRONLY, 0);
+    }
+
+    // Start a new process group, so that `scanner_free()` can kill the
+    // command and anything it runs all in one go.
+    posix_spawnattr_t attributes;
+    posix_spawnattr_init(&attributes);
+    posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETPGROUP);
+    posix_spawnattr_setpgroup(&attributes, 0);
+
+    int status = posix_spawnp(
+        &source->child_pid, file, &actions, &attributes, argv, environ
+    );
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attributes);
+    close(stdout_pipe[1]);
+    if (status != 0) {
+        close(stdout_pipe[0]);
+        return false;
+    }
+    source->fd = stdout_pipe[0];
+    source->reaped = false;
+    source->reader->running++;
+    return true;
+}
+
+/**
+ * Starts reading the output of each of the reader's sources on a thread of its
+ * own, and hands the reader over to its scanner.
+ */
+static void start(scanner_reader_t *reader) {
+    // A lone source with nothing to put in front of its candidates can be read
+    // straight into the scanner's buffer; otherwise, each source's candidates
+    // have to be copied in.
+    void *(*read)(void *) =
+        reader->source_count == 1 && !reader->sources[0].prefix
+        ? read_candidates
+        : read_copies;
+    reader->scanner->reader = reader;
+    for (unsigned i = 0; i < reader->source_count; i++) {
+        scanner_source_t *source = &reader->sources[i];
+        if (source->fd == -1) {
+            continue;
         }
-        if (dup2(stdout_pipe[1], 1) == -1) {
-            goto bail_child;
+        if (pthread_create(&source->thread, NULL, read, source) == 0) {
+            source->threaded = true;
+        } else {
+            // Do the reading on this thread instead.
+            read(source);
         }
-        if (close(stdout_pipe[1]) != 0) {
-            goto bail_child;
+    }
+
+    // In case there was nothing to read on other threads.
+    pthread_mutex_lock(&reader->mutex);
+    reader->done = reader->running == 0;
+    pthread_mutex_unlock(&reader->mutex);
+    scanner_wait(reader->scanner, 0);
+}
+
+void scanner_wait(scanner_t *scanner, unsigned count) {
+    scanner_reader_t *reader = scanner->reader;
+    if (!reader) {
+        return;
+    }
+    pthread_mutex_lock(&reader->mutex);
+    while (!reader->done && reader->count < count) {
+        pthread_cond_wait(&reader->changed, &reader->mutex);
+    }
+    scanner->count = reader->count;
+    bool done = reader->done;
+    pthread_mutex_unlock(&reader->mutex);
+
+    if (done) {
+        for (unsigned i = 0; i < reader->source_count; i++) {
+            if (reader->sources[i].threaded) {
+                pthread_join(reader->sources[i].thread, NULL);
+            }
         }
+        reader_free(reader);
+        scanner->reader = NULL;
+    }
+}
 
-        // Fork a shell to mimic behavior of `popen()`.
-        execl("/bin/sh", "sh", "-c", command, NULL);
+void scanner_index(scanner_t *scanner, unsigned threads) {
+    if (scanner->index || scanner->reader) {
+        // Already built, or it's too soon.
+        return;
+    }
+    scanner_indexer_t *indexer = scanner->indexer;
+    if (!indexer) {
+        if (scanner->count < INDEX_THRESHOLD) {
+            return;
+        }
+        indexer = xcalloc(1, sizeof(scanner_indexer_t));
+        indexer->scanner = scanner;
+        indexer->threads = threads;
+        atomic_init(&indexer->done, false);
+        if (pthread_create(&indexer->thread, NULL, build_index, indexer) != 0) {
+            // Searches will just have to do without.
+            free(indexer);
+            return;
+        }
+        scanner->indexer = indexer;
+    } else if (atomic_load(&indexer->done)) {
+        pthread_join(indexer->thread, NULL);
+        scanner->index = indexer->index;
+        scanner->indexer = NULL;
+        free(indexer);
+    }
+}
 
-bail_child:
-        _exit(1);
+/**
+ * Builds the index for `scanner_index()`, in the background.
+ */
+static void *build_index(void *scanner_indexer) {
+    scanner_indexer_t *indexer = scanner_indexer;
+    pool_t *pool = indexer->threads > 1 ? pool_new(indexer->threads - 1) : NULL;
+    indexer->index = ngram_index_new(indexer->scanner, pool);
+    if (pool) {
+        pool_free(pool);
     }
+    atomic_store(&indexer->done, true);
+    return NULL;
+}
 
-    // In parent.
-    int status = close(stdout_pipe[1]);
-    if (status != 0) {
-        goto bail_parent;
+/**
+ * Makes the first `count` candidates available to `scanner_wait()`.
+ */
+static void publish(scanner_reader_t *reader, unsigned count) {
+    pthread_mutex_lock(&reader->mutex);
+    reader->count = count;
+    pthread_cond_broadcast(&reader->changed);
+    pthread_mutex_unlock(&reader->mutex);
+}
+
+/**
+ * Waits for the source's command to exit, and tells `scanner_wait()` once all
+ * of the commands have.
+ */
+static void finish_source(scanner_source_t *source) {
+    scanner_reader_t *reader = source->reader;
+    close(source->fd);
+
+    // Wait for the child to exit without reaping it, and then reap it while
+    // holding the lock, so that `scanner_free()` and `stop_sources()` can never
+    // send a signal to a recycled process ID.
+    siginfo_t info;
+    if (waitid(P_PID, source->child_pid, &info, WEXITED | WNOWAIT) == -1) {
+        // Swallow the error.
+    }
+    pthread_mutex_lock(&reader->mutex);
+    if (waitpid(source->child_pid, NULL, 0) == -1) {
+        // Swallow the error.
+    }
+    source->reaped = true;
+    reader->running--;
+    if (!reader->running) {
+        reader->done = true;
+        pthread_cond_broadcast(&reader->changed);
+    }
+    pthread_mutex_unlock(&reader->mutex);
+}
+
+/**
+ * Sends `signum` to any commands that are still running, and tells the threads
+ * reading from them to stop. The caller must hold the reader's `mutex`.
+ */
+static void stop_sources(scanner_reader_t *reader, int signum) {
+    atomic_store(&reader->stop, true);
+    for (unsigned i = 0; i < reader->source_count; i++) {
+        if (!reader->sources[i].reaped) {
+            kill(-reader->sources[i].child_pid, signum);
+        }
     }
-    char *start = scanner->buffer;
-    char *end = scanner->buffer;
-    ssize_t read_count;
-    while ((read_count = read(stdout_pipe[0], end, 4096)) != 0) {
-        if (read_count < 0) {
+}
+
+/**
+ * Reads records from the output of a scanner's only command straight into the
+ * scanner's buffer, until the command finishes (or until we've read
+ * `max_files` of them), publishing them as it goes.
+ */
+static void *read_candidates(void *scanner_source) {
+    scanner_source_t *source = scanner_source;
+    scanner_reader_t *reader = source->reader;
+    char terminator =
+        reader->terminator == SCANNER_TERMINATOR_NUL ? '\0' : '\n';
+    unsigned count = 0;
+    unsigned offsets[SPLIT_BATCH];
+
+    // Output is read straight into the buffer, where it stays: `start` is the
+    // beginning of the record currently being read, and `scanned` is how far
+    // we have looked for its terminator.
+    char *start = reader->scanner->buffer;
+    char *scanned = start;
+    char *end = start;
+    char *limit = start + reader->scanner->buffer_size;
+    size_t read_size = MIN_READ_SIZE;
+    bool eof = false;
+    while (end < limit) {
+        size_t available = limit - end;
+        size_t size = read_size < available ? read_size : available;
+        ssize_t read_count = read(source->fd, end, size);
+        if (read_count == 0) {
+            eof = true;
+            break;
+        } else if (read_count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
             // A read error, but we may as well try and proceed gracefully.
             break;
         }
+        if ((size_t)read_count == size && read_size < MAX_READ_SIZE) {
+            read_size *= 2;
+        }
         end += read_count;
-        while (start < end) {
-            if (start[0] == 0) { // TODO: terminator may not always be NUL (-z)
-                start++;
-                continue;
+
+        // Split up what has arrived, in a single pass that picks up from where
+        // the last one left off (so a record that straddles several reads only
+        // gets looked at once).
+        while (scanned < end) {
+            size_t found =
+                split(scanned, end - scanned, terminator, offsets, SPLIT_BATCH);
+            for (size_t i = 0; i < found; i++) {
+                char *next_end = scanned + offsets[i];
+                if (!add_candidate(reader, start, next_end, &count)) {
+                    kill(-source->child_pid, SIGTERM);
+                    goto finish;
+                }
+                start = next_end + 1;
             }
-            char *next_end = memchr(start, 0, end - start);
-            if (!next_end) {
+            scanned = found == SPLIT_BATCH ? start : end;
+        }
+        publish(reader, count);
+        if (atomic_load(&reader->stop)) {
+            break;
+        }
+    }
+
+    if (end == limit) {
+        // Out of room. Whatever follows the last terminator may be only part
+        // of a record, so it gets dropped, and there's no point letting the
+        // command carry on.
+        kill(-source->child_pid, SIGTERM);
+    } else if (eof && start < end) {
+        // Take whatever follows the last terminator, as line-oriented commands
+        // don't always end their output with one.
+        add_candidate(reader, start, end, &count);
+    }
+
+finish:
+    publish(reader, count);
+    finish_source(source);
+    return NULL;
+}
+
+/**
+ * Adds the record that runs from `start` up to `end` (where its terminator is,
+ * or would be) as the next candidate, unless it is empty, and overwrites the
+ * terminator with a NUL so that all candidates end with one.
+ *
+ * Returns `false` once `max_files` candidates have been added.
+ */
+static bool add_candidate(
+    scanner_reader_t *reader,
+    char *start,
+    char *end,
+    unsigned *count
+) {
+    if (
+        reader->terminator == SCANNER_TERMINATOR_CRLF &&
+        end > start &&
+        end[-1] == '\r'
+    ) {
+        end--;
+    }
+    if (end == start) {
+        // Skip empty records.
+        return true;
+    }
+    int length = end - start - reader->drop;
+    if (length < 0) {
+        // Skip records too short to have `drop` chars taken off them (eg. a
+        // stray CR when splitting on LF).
+        return true;
+    }
+    *end = '\0';
+    str_init(
+        &reader->scanner->candidates[(*count)++], start + reader->drop, length
+    );
+    return !reader->max_files || *count < reader->max_files;
+}
+
+/**
+ * Reads records from the output of one of a scanner's commands into a buffer
+ * of its own, and from there copies them (each with the source's prefix in
+ * front of it) into the scanner's buffer, which it shares with the other
+ * commands, until the command finishes or we have enough.
+ */
+static void *read_copies(void *scanner_source) {
+    scanner_source_t *source = scanner_source;
+    scanner_reader_t *reader = source->reader;
+    char terminator =
+        reader->terminator == SCANNER_TERMINATOR_NUL ? '\0' : '\n';
+    unsigned offsets[SPLIT_BATCH];
+
+    // As in `read_candidates()`, except that once the buffer is full, the
+    // partial record at the end of it gets moved to the front to make room.
+    char *buffer = xmalloc(MAX_READ_SIZE);
+    char *start = buffer;
+    char *scanned = start;
+    char *end = start;
+    char *limit = buffer + MAX_READ_SIZE;
+    bool eof = false;
+    while (true) {
+        if (end == limit) {
+            if (start == buffer) {
+                // Record too long to be a path; give up on this command.
                 break;
             }
-            char *path = start + drop;
-            int length = next_end - start - drop;
-            if (length < 0) {
-                goto bail_parent;
+            size_t partial = end - start;
+            memmove(buffer, start, partial);
+            start = buffer;
+            end = scanned = buffer + partial;
+        }
+        ssize_t read_count = read(source->fd, end, limit - end);
+        if (read_count == 0) {
+            eof = true;
+            break;
+        } else if (read_count < 0) {
+            if (errno == EINTR) {
+                continue;
             }
-            start = next_end + 1;
-            str_init(&scanner->candidates[scanner->count++], path, length);
+            break;
+        }
+        end += read_count;
 
-            if (max_files && scanner->count >= max_files) {
-                kill(child_pid, SIGKILL);
-                goto bail_parent;
+        while (scanned < end) {
+            size_t found =
+                split(scanned, end - scanned, terminator, offsets, SPLIT_BATCH);
+            if (found && !add_copies(source, start, scanned, offsets, found)) {
+                goto finish;
             }
+            if (found) {
+                start = scanned + offsets[found - 1] + 1;
+            }
+            scanned = found == SPLIT_BATCH ? start : end;
+        }
+        if (atomic_load(&reader->stop)) {
+            break;
         }
     }
 
-bail_parent:
-    if (wait(&child_pid) == -1) {
-        // Swallow the error.
+    if (eof && start < end) {
+        unsigned offset = end - start;
+        add_copies(source, start, start, &offset, 1);
     }
 
-out:
-    return scanner;
+finish:
+    free(buffer);
+    finish_source(source);
+    return NULL;
+}
+
+/**
+ * Copies the `found` records that end at `offsets` (relative to `scanned`),
+ * the first of which begins at `start`, into the scanner's buffer, and adds
+ * them as candidates, skipping the same ones that `add_candidate()` does, and
+ * any that are another source's root (see `is_root()`).
+ *
+ * Returns `false` when no more candidates should be read.
+ */
+static bool add_copies(
+    scanner_source_t *source,
+    char *start,
+    char *scanned,
+    const unsigned *offsets,
+    size_t found
+) {
+    scanner_reader_t *reader = source->reader;
+    scanner_t *scanner = reader->scanner;
+    bool more = true;
+    pthread_mutex_lock(&reader->mutex);
+    for (size_t i = 0; i < found; i++) {
+        if (atomic_load(&reader->stop)) {
+            // Another source ran out of room, or took us to `max_files`.
+            more = false;
+            break;
+        }
+        char *record = start;
+        char *end = scanned + offsets[i];
+        start = end + 1;
+        if (
+            reader->terminator == SCANNER_TERMINATOR_CRLF &&
+            end > record &&
+            end[-1] == '\r'
+        ) {
+            end--;
+        }
+        if (end == record || (size_t)(end - record) < reader->drop) {
+            continue;
+        }
+        record += reader->drop;
+        size_t length = end - record;
+        size_t total = source->prefix_length + length;
+        if (reader->used + total + 1 > (size_t)scanner->buffer_size) {
+            // Out of room.
+            stop_sources(reader, SIGTERM);
+            more = false;
+            break;
+        }
+        char *contents = scanner->buffer + reader->used;
+        if (source->prefix_length) {
+            memcpy(contents, source->prefix, source->prefix_length);
+        }
+        memcpy(contents + source->prefix_length, record, length);
+        contents[total] = '\0';
+        if (is_root(reader, contents, total)) {
+            continue;
+        }
+        reader->used += total + 1;
+        str_init(&scanner->candidates[reader->count++], contents, total);
+        if (reader->max_files && reader->count >= reader->max_files) {
+            stop_sources(reader, SIGTERM);
+            more = false;
+            break;
+        }
+    }
+    pthread_cond_broadcast(&reader->changed);
+    pthread_mutex_unlock(&reader->mutex);
+    return more;
+}
+
+/**
+ * Returns `true` if the `length` bytes at `path` name the directory that one
+ * of the reader's sources puts in front of its candidates (ie. its prefix,
+ * minus the trailing slash). That makes it the root of a source (eg. a git
+ * submodule, which shows up in the superproject's own listing) rather than a
+ * file.
+ */
+static bool is_root(scanner_reader_t *reader, const char *path, size_t length) {
+    for (unsigned i = 0; i < reader->source_count; i++) {
+        scanner_source_t *source = &reader->sources[i];
+        if (
+            source->prefix_length == length + 1 &&
+            source->prefix[length] == '/' &&
+            memcmp(source->prefix, path, length) == 0
+        ) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void reader_free(scanner_reader_t *reader) {
+    for (unsigned i = 0; i < reader->source_count; i++) {
+        free(reader->sources[i].prefix);
+    }
+    pthread_mutex_destroy(&reader->mutex);
+    pthread_cond_destroy(&reader->changed);
+    free(reader);
 }
 
 scanner_t *scanner_new_str(str_t *candidates, unsigned count) {
@@ -155,6 +822,60 @@ scanner_t *scanner_new(
     return scanner;
 }
 
+void scanner_fold(scanner_t *scanner) {
+    if (!scanner->folded) {
+        scanner->folded_size = slab_size(scanner);
+        scanner->folded = xmap(scanner->folded_size);
+    }
+    char *folded = scanner->folded + scanner->folded_length;
+    for (unsigned i = scanner->folded_count; i < scanner->count; i++) {
+        const char *contents = scanner->candidates[i].contents;
+        size_t length = scanner->candidates[i].length;
+        for (size_t j = 0; j < length; j++) {
+            char c = contents[j];
+            folded[j] = c >= 'A' && c <= 'Z' ? c | 0x20 : c;
+        }
+        folded += length;
+    }
+    scanner->folded_count = scanner->count;
+    scanner->folded_length = folded - scanner->folded;
+}
+
+void scanner_classify(scanner_t *scanner) {
+    if (!scanner->boundaries) {
+        scanner->boundaries_size = slab_size(scanner);
+        scanner->boundaries = xmap(scanner->boundaries_size);
+    }
+    uint8_t *boundaries = scanner->boundaries + scanner->boundaries_length;
+    for (unsigned i = scanner->boundaries_count; i < scanner->count; i++) {
+        size_t length = scanner->candidates[i].length;
+        commandt_score_boundaries(
+            scanner->candidates[i].contents, length, boundaries
+        );
+        boundaries += length;
+    }
+    scanner->boundaries_count = scanner->count;
+    scanner->boundaries_length = boundaries - scanner->boundaries;
+}
+
+/**
+ * Returns the size of a buffer with room for one byte per byte of every
+ * candidate that `scanner` has, or will have.
+ */
+static size_t slab_size(scanner_t *scanner) {
+    if (scanner->reader) {
+        // Candidates yet to come will fit anywhere that their contents do.
+        return scanner->buffer_size;
+    }
+    size_t size = 0;
+    for (unsigned i = 0; i < scanner->count; i++) {
+        size += scanner->candidates[i].length;
+    }
+
+    // Never zero, because `mmap()` can't map an empty region.
+    return size ? size : 1;
+}
+
 static const char *NUL_BYTE = "\0";
 static const char *L_BRACE = "{";
 static const char *R_BRACE = "}";
@@ -180,6 +901,23 @@ str_t *scanner_dump(scanner_t *scanner) {
 }
 
 void scanner_free(scanner_t *scanner) {
+    scanner_reader_t *reader = scanner->reader;
+    if (reader) {
+        // Cut the commands short rather than waiting for them to finish.
+        pthread_mutex_lock(&reader->mutex);
+        stop_sources(reader, SIGKILL);
+        pthread_mutex_unlock(&reader->mutex);
+        scanner_wait(scanner, UINT_MAX);
+    }
+
+    scanner_indexer_t *indexer = scanner->indexer;
+    if (indexer) {
+        // The build can't be interrupted, so let it finish.
+        pthread_join(indexer->thread, NULL);
+        ngram_index_free(indexer->index);
+        free(indexer);
+    }
+
     if (scanner->candidates && scanner->candidates_size != UNOWNED) {
         for (unsigned i = 0; i < scanner->count; i++) {
             str_t str = scanner->candidates[i];
@@ -195,6 +933,18 @@ void scanner_free(scanner_t *scanner) {
         xmunmap(scanner->buffer, scanner->buffer_size);
     }
 
+    if (scanner->index) {
+        ngram_index_free(scanner->index);
+    }
+
+    if (scanner->folded) {
+        xmunmap(scanner->folded, scanner->folded_size);
+    }
+
+    if (scanner->boundaries) {
+        xmunmap(scanner->boundaries, scanner->boundaries_size);
+    }
+
     free(scanner);
 }
 
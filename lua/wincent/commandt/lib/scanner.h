@@ -10,17 +10,35 @@
 #include "str.h" /* for str_t */
 
 // Define short names for convenience, but all external symbols need prefixes.
+#define scanner_new_argv commandt_scanner_new_argv
 #define scanner_new_copy commandt_scanner_new_copy
+#define scanner_new_multi commandt_scanner_new_multi
 #define scanner_new_str commandt_scanner_new_str
 #define scanner_new commandt_scanner_new
 #define scanner_dump commandt_scanner_dump
+#define scanner_classify commandt_scanner_classify
+#define scanner_fold commandt_scanner_fold
+#define scanner_index commandt_scanner_index
 #define scanner_free commandt_scanner_free
+#define scanner_wait commandt_scanner_wait
 
 // This one is special: ideally, the underlying symbol would be
 // `commandt_scanner_new_exec()`, but I don't want to break userspace (see the
 // note in lib.lua), so it keeps its old name.
 #define scanner_new_exec commandt_scanner_new_command
 
+/**
+ * What separates the records in a command's output (see `scanner_new_exec()`).
+ */
+typedef enum {
+    SCANNER_TERMINATOR_NUL,
+    SCANNER_TERMINATOR_LF,
+
+    // Like `SCANNER_TERMINATOR_LF`, but a CR that precedes the LF is dropped
+    // too.
+    SCANNER_TERMINATOR_CRLF,
+} scanner_terminator_t;
+
 /**
  * Create a new `scanner_t` struct initialized with `candidates`.
  *
@@ -30,15 +48,68 @@
 scanner_t *scanner_new_copy(const char **candidates, unsigned count);
 
 /**
- * Create a new `scanner_t` struct that will be populated by `execl()`-ing the
- * NUL-terminated `command` string.
+ * Create a new `scanner_t` struct that will be populated by running the
+ * NUL-terminated `command` string with "/bin/sh", and splitting its output
+ * into records at each `terminator`. Empty records are skipped, and a final
+ * record is taken even if the output stops without a terminator.
  *
  * The `drop` parameter indicates how many characters of prefix, if any, should
  * be omitted from the strings returned by the scanner; commonly, this will be
  * 0, but for commands such as `find .` which prefix all paths with "./", `drop`
  * would be 2.
+ *
+ * Once `max_files` candidates have been read (if `max_files` is non-zero), or
+ * the scanner's buffer is full, the command's process group is sent `SIGTERM`
+ * and the rest of its output is ignored. In the latter case, a record that
+ * didn't fit in the buffer in its entirety is dropped.
+ *
+ * Returns as soon as the command has been started, leaving a background thread
+ * to read its output; see `scanner_wait()`.
+ */
+scanner_t *scanner_new_exec(
+    const char *command,
+    unsigned drop,
+    unsigned max_files,
+    scanner_terminator_t terminator
+);
+
+/**
+ * Like `scanner_new_exec()`, but for commands that don't need a shell: runs
+ * the program named by `argv[0]` (looked up in the `PATH` if it contains no
+ * slash) directly, with the NULL-terminated `argv` as its arguments.
+ *
+ * Anything the command writes to its standard error is discarded.
  */
-scanner_t *scanner_new_exec(const char *command, unsigned drop, unsigned max_files);
+scanner_t *scanner_new_argv(
+    const char **argv,
+    unsigned drop,
+    unsigned max_files,
+    scanner_terminator_t terminator
+);
+
+/**
+ * Like `scanner_new_argv()`, but runs `count` commands at once, each reading
+ * its output on a thread of its own, and gathers all of their candidates into
+ * one scanner, in the order in which they arrive.
+ *
+ * `argvs` holds the NULL-terminated argv of each command, one after another.
+ * Each command's candidates have its entry in `prefixes` (which may be `NULL`
+ * or empty, and should otherwise end in a slash) put in front of them after
+ * `drop` characters have been taken off. Candidates that then name the
+ * directory of another command's prefix are skipped, as that makes them that
+ * command's root (eg. a git submodule, in the superproject's listing) rather
+ * than files.
+ *
+ * `max_files` applies to the total.
+ */
+scanner_t *scanner_new_multi(
+    unsigned count,
+    const char **argvs,
+    const char **prefixes,
+    unsigned drop,
+    unsigned max_files,
+    scanner_terminator_t terminator
+);
 
 /**
  * Create a new `scanner_t` struct initialized with `candidates` provided by
@@ -73,8 +144,48 @@ scanner_t *scanner_new(
  */
 str_t *scanner_dump(scanner_t *scanner);
 
+/**
+ * Brings `scanner->folded` up to date with lowercase copies of all of the
+ * candidates, in order, with no separators.
+ *
+ * This costs as much memory again as the candidates themselves, so it is up to
+ * the matcher to decide whether it is worth it.
+ */
+void scanner_fold(scanner_t *scanner);
+
+/**
+ * Brings `scanner->boundaries` up to date with the
+ * `commandt_score_boundaries()` of all of the candidates, in order, with no
+ * separators.
+ */
+void scanner_classify(scanner_t *scanner);
+
+/**
+ * Asks for `scanner->index` (see "ngram.h") to be built on a background thread
+ * with up to `threads` threads, as soon as the scanner is complete (ie. once
+ * `scanner_wait()` has taken in the last of its candidates), if it has enough
+ * candidates to make that worthwhile.
+ *
+ * `scanner->index` stays `NULL` until a later call finds that the build has
+ * finished, so callers should keep calling this (it's cheap) until then.
+ */
+void scanner_index(scanner_t *scanner, unsigned threads);
+
+/**
+ * For a scanner still being populated in the background, updates `count` to
+ * take in the candidates read so far, first waiting until there are at least
+ * `count` of them (or until there won't be any more).
+ *
+ * Pass 0 to not wait at all, or `UINT_MAX` to wait for everything. Does
+ * nothing for other scanners.
+ */
+void scanner_wait(scanner_t *scanner, unsigned count);
+
 /**
  * Frees a previously created `scanner_t` structure.
+ *
+ * If the scanner is still being populated, the command populating it is
+ * killed.
  */
 void scanner_free(scanner_t *scanner);
 
@@ -6,215 +6,582 @@
 #include "score.h"
 
 #include <stddef.h> /* for size_t */
+#include <stdint.h> /* for UINT8_MAX, uint32_t, uint64_t, uint8_t */
 #ifdef DEBUG_SCORING
 #include <stdio.h> /* for fprintf, stdout, snprintf */
 #endif
-#include <stdlib.h> /* for NULL */
+#include <stdlib.h> /* for free(), NULL */
+#include <string.h> /* for memset() */
 
-// Use a struct to make passing params during recursion easier.
+#include "prescan.h" /* for prescan() */
+#include "xmalloc.h" /* for xcalloc(), xmalloc() */
+
+/**
+ * A memoized score, only valid when `generation` matches the generation of the
+ * `score_scratch_t` it belongs to.
+ */
+typedef struct {
+    float score;
+    uint32_t generation;
+} memo_t;
+
+// Use a struct to make passing params around easier.
 typedef struct {
     haystack_t *haystack;
     const char *haystack_p;
+    const char *match_p; // What to compare the needle with: see `case_t`.
+    const uint8_t *boundaries_p; // One `boundary_t` per haystack char.
     const char *needle_p;
     size_t needle_length;
     size_t *rightmost_match_p; // Rightmost match for each char in needle.
     float max_score_per_char;
-    bool always_show_dot_files;
-    bool never_show_dot_files;
-    bool ignore_case;
-    float *memo; // Memoization.
+    memo_t *memo; // Memoization.
+    uint32_t generation; // Generation of the valid entries in `memo`.
 } matchinfo_t;
 
 // TODO: see if can come up with a better name than matchinfo_t
 
-static float recursive_match(
-    matchinfo_t *m, // Sharable meta-data.
-    size_t haystack_idx, // Where in the path string to start.
-    size_t needle_idx, // Where in the needle string to start.
-    size_t last_idx, // Location of last matched character.
-    float score // Cumulative score so far.
+/**
+ * How dot-files are treated, derived from the matcher's
+ * `always_show_dot_files` and `never_show_dot_files` settings.
+ */
+typedef enum {
+    DOT_FILES_HIDDEN, // Never match dot-files.
+    DOT_FILES_SHOWN, // Always match dot-files.
+    DOT_FILES_SEARCHED, // Only match dot-files when the needle has a dot there.
+} dot_files_t;
+
+/**
+ * How the needle is compared with a haystack.
+ */
+typedef enum {
+    CASE_MATCH, // Compare as-is.
+    CASE_IGNORE, // Downcase each haystack char before comparing.
+    CASE_FOLDED, // Compare as-is against the haystack's lowercase copy.
+} case_t;
+
+/**
+ * State of one level of the search in `iterative_match()`, corresponding to
+ * what used to be a single recursive call.
+ */
+typedef struct {
+    size_t haystack_idx; // Where in the path string to resume the next char.
+    size_t needle_idx; // Needle char currently being matched.
+    size_t j; // Position in the haystack currently being looked at.
+    size_t last_idx; // Location of last matched character.
+    float score; // Cumulative score so far.
+    float seen_score; // Best score found by alternatives explored so far.
+    float score_for_char; // Pending contribution of the match at `j`.
+    memo_t *memoized;
+} frame_t;
+
+/**
+ * Used by `commandt_score_positions()`: the best score for matching the needle
+ * up to some char at some haystack position, and where the previous needle
+ * char matched to get it.
+ */
+typedef struct {
+    float score; // Negative if there is no way to match there.
+    unsigned from;
+} trace_t;
+
+struct score_scratch_t {
+    size_t *rightmost_match_p;
+    size_t rightmost_match_capacity;
+    frame_t *stack;
+    size_t stack_capacity;
+
+    // Rather than resetting every entry for every haystack, we bump the
+    // generation; entries from earlier haystacks are then treated as unset.
+    memo_t *memo;
+    size_t memo_capacity;
+    uint32_t generation;
+
+    trace_t *trace;
+    size_t trace_capacity;
+    uint8_t *boundaries;
+    size_t boundaries_capacity;
+};
+
+static inline bool memo_is_set(matchinfo_t *m, memo_t *memo) {
+    return memo->generation == m->generation;
+}
+
+static inline void memo_set(matchinfo_t *m, memo_t *memo, float score) {
+    memo->score = score;
+    memo->generation = m->generation;
+}
+
+// Indexed by `boundary_t`.
+static const float boundary_factors[] = {
+    [BOUNDARY_NONE] = 0.0f, // Unused; see `score_for_char()`.
+    [BOUNDARY_SLASH] = 0.9f,
+    [BOUNDARY_WORD] = 0.8f,
+    [BOUNDARY_DOT] = 0.7f,
+};
+
+static float score_for_char(matchinfo_t *m, size_t j, size_t last_idx) {
+    float score_for_char = m->max_score_per_char;
+    size_t distance = j - last_idx;
+
+    if (distance > 1) {
+        uint8_t boundary = m->boundaries_p[j];
+
+        // If no "special" chars behind char, factor diminishes as distance
+        // from last matched char increases.
+        float factor = boundary == BOUNDARY_NONE
+            ? (1.0f / distance) * 0.75f
+            : boundary_factors[boundary];
+        score_for_char *= factor;
+    }
+    return score_for_char;
+}
+
+/**
+ * Takes the match at `frame->j`, having explored the alternatives to it.
+ *
+ * Returns `true` if that completes a match of the whole needle.
+ */
+static inline bool take_match(matchinfo_t *m, frame_t *frame) {
+    frame->last_idx = frame->j;
+    frame->haystack_idx = frame->j + 1;
+    frame->score += frame->score_for_char;
+    memo_set(
+        m,
+        frame->memoized,
+        frame->seen_score > frame->score ? frame->seen_score : frame->score
+    );
+    return frame->needle_idx == m->needle_length - 1;
+}
+
+/**
+ * Finds the best-scoring way of matching the needle against the haystack.
+ *
+ * Each time a needle char matches, we first explore (by pushing a new frame
+ * onto `stack`) matching the same char further along, and then take the match,
+ * with `m->memo` recording the best score found from each (haystack position,
+ * needle char) pair so that it is only explored once.
+ *
+ * This is a loop over an explicit stack rather than a recursion, so the depth
+ * of the search is bounded only by the size of `stack`, which must have room
+ * for `rightmost_match_p[needle_length - 1] + 1` frames. The order in which
+ * matches are explored, and therefore the memoized values and the final score,
+ * are exactly those of the recursive formulation.
+ *
+ * Always inlined, so that each scorer variant (see `DEFINE_SCORER()`) gets a
+ * copy in which `ignore_case` and `dot_files` are constants, and the tests that
+ * depend on them are folded out of the inner loops.
+ *
+ * Note that `m->match_p` (rather than `m->haystack_p`) is used for comparisons,
+ * which is fine for the dot-file checks too, because downcasing doesn't affect
+ * "." or "/".
+ */
+static inline __attribute__((always_inline)) float iterative_match(
+    matchinfo_t *m,
+    frame_t *stack,
+    const bool ignore_case,
+    const dot_files_t dot_files
 ) {
-    float *memoized = NULL;
-    float seen_score = 0.0f;
-    const char *haystack_contents = m->haystack_p;
-
-    // Iterate over needle.
-    for (size_t i = needle_idx; i < m->needle_length; i++) {
-        char needle_char = m->needle_p[i];
-
-        // Iterate over (valid range of) haystack.
-        for (size_t j = haystack_idx; j <= m->rightmost_match_p[i]; j++) {
-            char c = needle_char;
-            char d = haystack_contents[j];
-            char d_lower = d >= 'A' && d <= 'Z' ? d | 0x20 : d;
-            if (d == '.') {
-                if (j == 0 ||
-                    haystack_contents[j - 1] == '/') { // This is a dot-file.
-                    int dot_search = c == '.'; // Searching for a dot.
-                    if (m->never_show_dot_files ||
-                        (!dot_search && !m->always_show_dot_files)) {
-                        memoized = &m->memo[j * m->needle_length + i];
-                        if (*memoized == UNSET_SCORE) {
-                            *memoized = 0.0f;
-                        }
-                        return 0.0f;
-                    }
-                }
-            }
+    const char *haystack_contents = m->match_p;
+    const uint8_t *boundaries = m->boundaries_p;
+    const char *needle_p = m->needle_p;
+    size_t needle_length = m->needle_length;
+    size_t *rightmost_match_p = m->rightmost_match_p;
+    size_t depth = 0;
+    frame_t *frame = stack;
+    float result;
 
-            char match_char = m->ignore_case ? d_lower : d;
-            if (c == match_char) {
-                memoized = &m->memo[j * m->needle_length + i];
-                if (*memoized != UNSET_SCORE) {
-                    return *memoized > seen_score ? *memoized : seen_score;
-                }
+    frame->haystack_idx = 0;
+    frame->needle_idx = 0;
+    frame->j = 0;
+    frame->last_idx = 0;
+    frame->score = 0.0f;
+    frame->seen_score = 0.0f;
+    frame->memoized = NULL;
+
+    while (true) {
+        // Iterate over needle.
+        for (; frame->needle_idx < needle_length;
+             frame->needle_idx++, frame->j = frame->haystack_idx) {
+            size_t i = frame->needle_idx;
+            char c = needle_p[i];
+            size_t rightmost = rightmost_match_p[i];
+            bool hide_dot_files = dot_files == DOT_FILES_HIDDEN ||
+                (dot_files == DOT_FILES_SEARCHED && c != '.');
 
-                // Calculate score.
-                float score_for_char = m->max_score_per_char;
-                size_t distance = j - last_idx;
-
-                if (distance > 1) {
-                    float factor = 1.0f;
-                    char last = haystack_contents[j - 1];
-                    if (last == '/') {
-                        factor = 0.9f;
-                    } else if (
-                        last == '-' || last == '_' || last == ' ' ||
-                        (last >= '0' && last <= '9')
-                    ) {
-                        factor = 0.8f;
-                    } else if (last >= 'a' && last <= 'z' && d >= 'A' && d <= 'Z') {
-                        factor = 0.8f;
-                    } else if (last == '.') {
-                        factor = 0.7f;
-                    } else {
-                        // If no "special" chars behind char, factor diminishes
-                        // as distance from last matched char increases.
-                        factor = (1.0f / distance) * 0.75f;
+            // Iterate over (valid range of) haystack.
+            for (; frame->j <= rightmost; frame->j++) {
+                size_t j = frame->j;
+                char d = haystack_contents[j];
+                if (d == '.' && hide_dot_files &&
+                    boundaries[j] == BOUNDARY_SLASH) {
+                    // This is a dot-file.
+                    memo_t *memoized = &m->memo[j * needle_length + i];
+                    if (!memo_is_set(m, memoized)) {
+                        memo_set(m, memoized, 0.0f);
                     }
-                    score_for_char *= factor;
+                    result = 0.0f;
+                    goto pop;
                 }
 
-                if (j < m->rightmost_match_p[i]) {
-                    float sub_score =
-                        recursive_match(m, j + 1, i, last_idx, score);
-                    if (sub_score > seen_score) {
-                        seen_score = sub_score;
+                char d_lower = d >= 'A' && d <= 'Z' ? d | 0x20 : d;
+                char match_char = ignore_case ? d_lower : d;
+                if (c == match_char) {
+                    frame->memoized = &m->memo[j * needle_length + i];
+                    if (memo_is_set(m, frame->memoized)) {
+                        result = frame->memoized->score > frame->seen_score
+                            ? frame->memoized->score
+                            : frame->seen_score;
+                        goto pop;
+                    }
+                    frame->score_for_char =
+                        score_for_char(m, j, frame->last_idx);
+                    if (j < rightmost) {
+                        goto descend;
+                    }
+                    if (take_match(m, frame)) {
+                        // Whole string matched.
+                        result = frame->memoized->score;
+                        goto pop;
                     }
                 }
-                last_idx = j;
-                haystack_idx = last_idx + 1;
-                score += score_for_char;
-                *memoized = seen_score > score ? seen_score : score;
-                if (i == m->needle_length - 1) {
-                    // Whole string matched.
-                    return *memoized;
-                }
             }
         }
+        memo_set(m, frame->memoized, frame->score);
+        result = frame->score;
+
+    pop:
+        // Hand the result back to the parent frame, which can then take the
+        // match that it was holding off on.
+        while (true) {
+            if (depth == 0) {
+                return result;
+            }
+            frame = &stack[--depth];
+            if (result > frame->seen_score) {
+                frame->seen_score = result;
+            }
+            if (!take_match(m, frame)) {
+                break;
+            }
+            // Whole string matched.
+            result = frame->memoized->score;
+        }
+        frame->j++;
+        continue;
+
+    descend:
+        // Explore matching the same char further along.
+        stack[depth + 1].haystack_idx = frame->j + 1;
+        stack[depth + 1].needle_idx = frame->needle_idx;
+        stack[depth + 1].j = frame->j + 1;
+        stack[depth + 1].last_idx = frame->last_idx;
+        stack[depth + 1].score = frame->score;
+        stack[depth + 1].seen_score = 0.0f;
+        stack[depth + 1].memoized = NULL;
+        frame = &stack[++depth];
+    }
+}
+
+/**
+ * Returns `buffer` if it already has room for `count` items of `size` bytes,
+ * otherwise frees it and returns a bigger (zero-filled) one, updating
+ * `capacity` to match.
+ */
+static void *reserve(
+    void *buffer,
+    size_t *capacity,
+    size_t count,
+    size_t size
+) {
+    if (count <= *capacity) {
+        return buffer;
+    }
+    size_t new_capacity = *capacity ? *capacity : 64;
+    while (new_capacity < count) {
+        new_capacity *= 2;
+    }
+    free(buffer);
+    *capacity = new_capacity;
+    return xcalloc(new_capacity, size);
+}
+
+score_scratch_t *commandt_score_scratch_new(void) {
+    score_scratch_t *scratch = xmalloc(sizeof(score_scratch_t));
+    scratch->rightmost_match_p = NULL;
+    scratch->rightmost_match_capacity = 0;
+    scratch->stack = NULL;
+    scratch->stack_capacity = 0;
+    scratch->memo = NULL;
+    scratch->memo_capacity = 0;
+    scratch->trace = NULL;
+    scratch->trace_capacity = 0;
+    scratch->boundaries = NULL;
+    scratch->boundaries_capacity = 0;
+
+    // Freshly (zero-)allocated entries must never look valid.
+    scratch->generation = 1;
+    return scratch;
+}
+
+void commandt_score_scratch_free(score_scratch_t *scratch) {
+    free(scratch->rightmost_match_p);
+    free(scratch->stack);
+    free(scratch->memo);
+    free(scratch->trace);
+    free(scratch->boundaries);
+    free(scratch);
+}
+
+// Bit positions used by `commandt_bitmask()`; letters use bits 0 to 25.
+#define BITMASK_DIGITS 26
+#define BITMASK_DOT 36
+#define BITMASK_UNDERSCORE 37
+#define BITMASK_HYPHEN 38
+#define BITMASK_SLASH 39
+#define BITMASK_SPACE 40
+#define BITMASK_OTHER 41
+
+/**
+ * Returns the bit position used for `c` by `commandt_bitmask()`.
+ */
+static inline unsigned bitmask_bit(unsigned char c) {
+    if (c >= 'a' && c <= 'z') {
+        return c - 'a';
+    } else if (c >= 'A' && c <= 'Z') {
+        return c - 'A';
+    } else if (c >= '0' && c <= '9') {
+        return BITMASK_DIGITS + (c - '0');
+    }
+    switch (c) {
+        case '.':
+            return BITMASK_DOT;
+        case '_':
+            return BITMASK_UNDERSCORE;
+        case '-':
+            return BITMASK_HYPHEN;
+        case '/':
+            return BITMASK_SLASH;
+        case ' ':
+            return BITMASK_SPACE;
+        default:
+            return BITMASK_OTHER;
+    }
+}
+
+uint64_t commandt_bitmask(const char *str, size_t length) {
+    uint64_t mask = 0;
+    for (size_t i = 0; i < length; i++) {
+        mask |= (uint64_t)1 << bitmask_bit((unsigned char)str[i]);
+    }
+    return mask;
+}
+
+static inline char fold(char c) {
+    return c >= 'A' && c <= 'Z' ? c | 0x20 : c;
+}
+
+/**
+ * Returns the bit used for the pair of adjacent characters `a` and `b` in
+ * `score_features_t.pairs`.
+ */
+static inline uint64_t pair_bit(char a, char b) {
+    uint32_t pair = (uint32_t)(unsigned char)fold(a) << 8 |
+        (unsigned char)fold(b);
+    return (uint64_t)1 << ((pair * 0x9e3779b1u) >> 26);
+}
+
+static inline uint8_t saturate(size_t count) {
+    return count < UINT8_MAX ? count : UINT8_MAX;
+}
+
+void commandt_score_boundaries(
+    const char *str,
+    size_t length,
+    uint8_t *boundaries
+) {
+    for (size_t i = 0; i < length; i++) {
+        char last = i ? str[i - 1] : '/';
+        char d = str[i];
+        if (last == '/') {
+            boundaries[i] = BOUNDARY_SLASH;
+        } else if (
+            last == '-' || last == '_' || last == ' ' ||
+            (last >= '0' && last <= '9')
+        ) {
+            boundaries[i] = BOUNDARY_WORD;
+        } else if (last >= 'a' && last <= 'z' && d >= 'A' && d <= 'Z') {
+            boundaries[i] = BOUNDARY_WORD;
+        } else if (last == '.') {
+            boundaries[i] = BOUNDARY_DOT;
+        } else {
+            boundaries[i] = BOUNDARY_NONE;
+        }
     }
-    return *memoized = score;
 }
 
-float commandt_score(haystack_t *haystack, matcher_t *matcher, bool ignore_case) {
+void commandt_score_features(
+    const char *str,
+    size_t length,
+    score_features_t *features
+) {
+    uint64_t pairs = 0;
+    size_t slashes = 0;
+    size_t words = 0;
+    size_t dots = 0;
+    for (size_t i = 1; i < length; i++) {
+        // Classify just as `commandt_score_boundaries()` does.
+        char last = str[i - 1];
+        char d = str[i];
+        pairs |= pair_bit(last, d);
+        slashes += last == '/';
+        words += last == '-' || last == '_' || last == ' ' ||
+            (last >= '0' && last <= '9') ||
+            (last >= 'a' && last <= 'z' && d >= 'A' && d <= 'Z');
+        dots += last == '.';
+    }
+    features->pairs = pairs;
+    features->head[0] = length > 0 ? fold(str[0]) : '\0';
+    features->head[1] = length > 1 ? fold(str[1]) : '\0';
+    features->slashes = saturate(slashes);
+    features->words = saturate(words);
+    features->dots = saturate(dots);
+    features->set = true;
+}
+
+/**
+ * Adds up the discounts on `*breaks` run starts, of which at most `available`
+ * can get the given `factor`, and takes those off `*breaks`.
+ */
+static inline float discount(
+    size_t *breaks,
+    uint8_t available,
+    float factor
+) {
+    size_t count = available == UINT8_MAX || *breaks < available
+        ? *breaks
+        : available;
+    *breaks -= count;
+    return count * (1.0f - factor);
+}
+
+float commandt_score_bound(
+    const score_features_t *features,
+    const char *needle,
+    size_t needle_length,
+    float max_score_per_char
+) {
+    if (needle_length == 0) {
+        return 1.0f;
+    }
+
+    // Unless it matches right at the start, the first char starts a run too.
+    char first = fold(needle[0]);
+    size_t breaks = first != features->head[0] && first != features->head[1];
+    for (size_t i = 1; i < needle_length; i++) {
+        if (!(features->pairs & pair_bit(needle[i - 1], needle[i]))) {
+            breaks++;
+        }
+    }
+
+    // Best factors first; see `score_for_char()`. Anything not following a
+    // special char is at least 2 chars from the previous match, so gets a
+    // factor of at most `0.75f / 2`.
+    float total = needle_length;
+    total -= discount(&breaks, features->slashes, 0.9f);
+    total -= discount(&breaks, features->words, 0.8f);
+    total -= discount(&breaks, features->dots, 0.7f);
+    total -= breaks * (1.0f - 0.75f / 2);
+    return total * max_score_per_char;
+}
+
+/**
+ * Scores `haystack` against `matcher->needle`; see `DEFINE_SCORER()`.
+ */
+static inline __attribute__((always_inline)) float score(
+    haystack_t *haystack,
+    uint64_t *bitmask,
+    matcher_t *matcher,
+    score_scratch_t *scratch,
+    const case_t case_mode,
+    const dot_files_t dot_files
+) {
     matchinfo_t m;
-    bool compute_bitmasks = haystack->bitmask == UNSET_BITMASK;
+    bool compute_bitmasks = *bitmask == UNSET_BITMASK;
+    bool ignore_case = case_mode == CASE_IGNORE;
     m.haystack = haystack;
     m.haystack_p = m.haystack->candidate->contents;
+    m.match_p = case_mode == CASE_FOLDED ? haystack->folded : m.haystack_p;
+    m.boundaries_p = haystack->boundaries;
     m.needle_p = matcher->needle;
     m.needle_length = matcher->needle_length;
     m.rightmost_match_p = NULL;
     m.max_score_per_char =
         (1.0f / m.haystack->candidate->length + 1.0f / m.needle_length) / 2;
-    m.always_show_dot_files = matcher->always_show_dot_files;
-    m.never_show_dot_files = matcher->never_show_dot_files;
-    m.ignore_case = ignore_case;
 
     // Special case for zero-length search string.
     if (m.needle_length == 0) {
         // Filter out dot files.
-        if (m.never_show_dot_files || !m.always_show_dot_files) {
+        if (dot_files != DOT_FILES_SHOWN) {
             for (size_t i = 0; i < m.haystack->candidate->length; i++) {
                 char c = m.haystack_p[i];
-                if (c == '.' && (i == 0 || m.haystack_p[i - 1] == '/')) {
+                if (c == '.' && m.boundaries_p[i] == BOUNDARY_SLASH) {
                     return -1.0f;
                 }
             }
         }
     } else {
-        if (haystack->bitmask != UNSET_BITMASK) {
-            if ((matcher->needle_bitmask & haystack->bitmask) !=
-                matcher->needle_bitmask) {
-                return 0.0f;
-            }
-        }
-
         // Pre-scan string:
         // - Bail if it can't match at all.
         // - Record rightmost match for each character (prune search space).
         // - Record bitmask for haystack to speed up future searches.
-        size_t rightmost_match_p[m.needle_length];
+        scratch->rightmost_match_p = reserve(
+            scratch->rightmost_match_p,
+            &scratch->rightmost_match_capacity,
+            m.needle_length,
+            sizeof(size_t)
+        );
+        size_t *rightmost_match_p = scratch->rightmost_match_p;
         m.rightmost_match_p = rightmost_match_p;
-        size_t needle_idx = m.needle_length - 1;
         size_t haystack_len = m.haystack->candidate->length;
-        size_t haystack_idx = haystack_len ? haystack_len - 1 : 0;
-        long mask = 0;
-        bool found_needle = false;
         const char *haystack_contents = m.haystack_p;
-        if (haystack_len) {
-            while (haystack_idx >= needle_idx) {
-                char c = haystack_contents[haystack_idx];
-                char lower = c >= 'A' && c <= 'Z' ? c | 0x20 : c;
-                if (m.ignore_case) {
-                    c = lower;
-                }
-                if (compute_bitmasks) {
-                    mask |= (1 << (lower - 'a'));
-                }
-
-                char d = m.needle_p[needle_idx];
-                if (c == d) {
-                    rightmost_match_p[needle_idx] = haystack_idx;
-                    if (needle_idx == 0) {
-                        found_needle = true;
-                        break;
-                    } else {
-                        needle_idx--;
-                    }
-                }
-
-                if (haystack_idx == 0) {
-                    break;
-                } else {
-                    haystack_idx--;
-                }
-            }
-        }
         if (compute_bitmasks) {
-            if (haystack_len) {
-                // In case we broke out of the loop early, compute rest of mask.
-                for (size_t i = 0; i <= haystack_idx; i++) {
-                    char c = haystack_contents[i];
-                    char lower = c >= 'A' && c <= 'Z' ? c | 0x20 : c;
-                    mask |= (1 << (lower - 'a'));
-                }
-            }
-            haystack->bitmask = mask;
+            *bitmask = commandt_bitmask(haystack_contents, haystack_len);
         }
-        if (!found_needle) {
+        if (!prescan(
+                m.match_p,
+                haystack_len,
+                m.needle_p,
+                m.needle_length,
+                ignore_case,
+                rightmost_match_p
+            )) {
             return 0.0f;
         }
 
         // Prepare for memoization.
         size_t haystack_limit = rightmost_match_p[m.needle_length - 1] + 1;
         size_t memo_size = m.needle_length * haystack_limit;
-        float memo[memo_size];
-        for (size_t i = 0; i < memo_size; i++) {
-            memo[i] = UNSET_SCORE;
+        scratch->memo = reserve(
+            scratch->memo, &scratch->memo_capacity, memo_size, sizeof(memo_t)
+        );
+        if (++scratch->generation == 0) {
+            // Wrapped around, so stale entries could now look valid.
+            memset(scratch->memo, 0, scratch->memo_capacity * sizeof(memo_t));
+            scratch->generation = 1;
         }
-        m.memo = memo;
-        float score = recursive_match(&m, 0, 0, 0, 0.0f);
+        scratch->stack = reserve(
+            scratch->stack,
+            &scratch->stack_capacity,
+            haystack_limit,
+            sizeof(frame_t)
+        );
+        m.memo = scratch->memo;
+        m.generation = scratch->generation;
+        float score =
+            iterative_match(&m, scratch->stack, ignore_case, dot_files);
 #ifdef DEBUG_SCORING
+        memo_t *memo = m.memo;
         fprintf(stdout, "   ");
         for (size_t i = 0; i < m.needle_length; i++) {
             fprintf(stdout, "    %c   ", m.needle_p[i]);
@@ -226,10 +593,10 @@ float commandt_score(haystack_t *haystack, matcher_t *matcher, bool ignore_case)
                 long haystack_idx = i / m.needle_length;
                 fprintf(stdout, "%c: ", m.haystack_p[haystack_idx]);
             }
-            if (memo[i] == UNSET_SCORE) {
+            if (!memo_is_set(&m, &memo[i])) {
                 snprintf(formatted, sizeof(formatted), "    -  ");
             } else {
-                snprintf(formatted, sizeof(formatted), " %-.4f", memo[i]);
+                snprintf(formatted, sizeof(formatted), " %-.4f", memo[i].score);
             }
             fprintf(stdout, "%s", formatted);
             if ((i + 1) % m.needle_length == 0) {
@@ -245,3 +612,216 @@ float commandt_score(haystack_t *haystack, matcher_t *matcher, bool ignore_case)
     }
     return 1.0f;
 }
+
+/**
+ * Defines a scorer with the given (constant) settings baked in.
+ *
+ * The settings are fixed for the duration of a search, so rather than testing
+ * them for every character of every haystack, we pick the right variant once
+ * per search with `commandt_scorer()`.
+ */
+#define DEFINE_SCORER(name, case_mode, dot_files) \
+    static float name( \
+        haystack_t *haystack, \
+        uint64_t *bitmask, \
+        matcher_t *matcher, \
+        score_scratch_t *scratch \
+    ) { \
+        return score( \
+            haystack, bitmask, matcher, scratch, case_mode, dot_files \
+        ); \
+    }
+
+DEFINE_SCORER(score_match_hidden, CASE_MATCH, DOT_FILES_HIDDEN)
+DEFINE_SCORER(score_match_shown, CASE_MATCH, DOT_FILES_SHOWN)
+DEFINE_SCORER(score_match_searched, CASE_MATCH, DOT_FILES_SEARCHED)
+DEFINE_SCORER(score_ignore_hidden, CASE_IGNORE, DOT_FILES_HIDDEN)
+DEFINE_SCORER(score_ignore_shown, CASE_IGNORE, DOT_FILES_SHOWN)
+DEFINE_SCORER(score_ignore_searched, CASE_IGNORE, DOT_FILES_SEARCHED)
+DEFINE_SCORER(score_folded_hidden, CASE_FOLDED, DOT_FILES_HIDDEN)
+DEFINE_SCORER(score_folded_shown, CASE_FOLDED, DOT_FILES_SHOWN)
+DEFINE_SCORER(score_folded_searched, CASE_FOLDED, DOT_FILES_SEARCHED)
+
+// Indexed by `case_t`, then by `dot_files_t`.
+static const scorer_t scorers[3][3] = {
+    {score_match_hidden, score_match_shown, score_match_searched},
+    {score_ignore_hidden, score_ignore_shown, score_ignore_searched},
+    {score_folded_hidden, score_folded_shown, score_folded_searched},
+};
+
+static dot_files_t get_dot_files(matcher_t *matcher) {
+    // `never_show_dot_files` wins if both are set.
+    return matcher->never_show_dot_files ? DOT_FILES_HIDDEN
+        : matcher->always_show_dot_files ? DOT_FILES_SHOWN
+                                         : DOT_FILES_SEARCHED;
+}
+
+scorer_t commandt_scorer(matcher_t *matcher, bool ignore_case) {
+    case_t case_mode = !ignore_case    ? CASE_MATCH
+        : matcher->fold_candidates ? CASE_FOLDED
+                                   : CASE_IGNORE;
+    return scorers[case_mode][get_dot_files(matcher)];
+}
+
+/**
+ * Returns `true` if, while looking for needle char `c`, the search has to stop
+ * at `haystack[j]` because it is the start of a hidden dot-file.
+ */
+static inline bool is_hidden_dot_file(
+    matchinfo_t *m,
+    size_t j,
+    char c,
+    dot_files_t dot_files
+) {
+    return m->haystack_p[j] == '.' && m->boundaries_p[j] == BOUNDARY_SLASH &&
+        (dot_files == DOT_FILES_HIDDEN ||
+         (dot_files == DOT_FILES_SEARCHED && c != '.'));
+}
+
+/**
+ * Does the work of `commandt_score_positions()`, with the given dot-file
+ * setting.
+ */
+static bool trace_positions(
+    matchinfo_t *m,
+    score_scratch_t *scratch,
+    bool ignore_case,
+    dot_files_t dot_files,
+    unsigned *positions
+) {
+    const char *haystack = m->haystack_p;
+    const char *needle = m->needle_p;
+    size_t needle_length = m->needle_length;
+    size_t *rightmost = m->rightmost_match_p;
+
+    // `trace[i * limit + j]` describes the best way of matching `needle[0]`
+    // through `needle[i]`, with `needle[i]` matching at `haystack[j]`, where
+    // each char contributes just as it does in `iterative_match()`.
+    size_t limit = rightmost[needle_length - 1] + 1;
+    scratch->trace = reserve(
+        scratch->trace,
+        &scratch->trace_capacity,
+        needle_length * limit,
+        sizeof(trace_t)
+    );
+    trace_t *trace = scratch->trace;
+    for (size_t i = 0; i < needle_length; i++) {
+        char c = needle[i];
+        trace_t *row = trace + i * limit;
+        for (size_t j = 0; j < limit; j++) {
+            row[j].score = -1.0f;
+        }
+        for (size_t j = i; j <= rightmost[i]; j++) {
+            if (is_hidden_dot_file(m, j, c, dot_files)) {
+                if (i == 0) {
+                    // Nothing past here is reachable for the first char.
+                    break;
+                }
+                continue;
+            }
+            char d = haystack[j];
+            if (ignore_case && d >= 'A' && d <= 'Z') {
+                d |= 0x20;
+            }
+            if (d != c) {
+                continue;
+            }
+            if (i == 0) {
+                row[j].score = score_for_char(m, j, 0);
+                row[j].from = 0;
+                continue;
+            }
+
+            // Look back for where the previous char matched, stopping at any
+            // hidden dot-file in between.
+            trace_t *previous_row = row - limit;
+            for (size_t p = j; p-- > i - 1;) {
+                if (previous_row[p].score >= 0.0f) {
+                    float score =
+                        previous_row[p].score + score_for_char(m, j, p);
+                    if (score > row[j].score) {
+                        row[j].score = score;
+                        row[j].from = p;
+                    }
+                }
+                if (is_hidden_dot_file(m, p, c, dot_files)) {
+                    break;
+                }
+            }
+        }
+    }
+
+    // Pick the best place for the last char, and trace back from there.
+    trace_t *row = trace + (needle_length - 1) * limit;
+    size_t best = limit;
+    for (size_t j = 0; j < limit; j++) {
+        if (row[j].score >= 0.0f &&
+            (best == limit || row[j].score > row[best].score)) {
+            best = j;
+        }
+    }
+    if (best == limit) {
+        return false;
+    }
+    for (size_t i = needle_length; i-- > 0;) {
+        positions[i] = best;
+        best = trace[i * limit + best].from;
+    }
+    return true;
+}
+
+bool commandt_score_positions(
+    str_t *candidate,
+    matcher_t *matcher,
+    bool ignore_case,
+    score_scratch_t *scratch,
+    unsigned *positions
+) {
+    matchinfo_t m;
+    m.haystack_p = candidate->contents;
+    m.needle_p = matcher->needle;
+    m.needle_length = matcher->needle_length;
+    m.max_score_per_char =
+        (1.0f / candidate->length + 1.0f / m.needle_length) / 2;
+    if (m.needle_length == 0) {
+        return true;
+    }
+
+    scratch->rightmost_match_p = reserve(
+        scratch->rightmost_match_p,
+        &scratch->rightmost_match_capacity,
+        m.needle_length,
+        sizeof(size_t)
+    );
+    m.rightmost_match_p = scratch->rightmost_match_p;
+    if (!prescan(
+            m.haystack_p,
+            candidate->length,
+            m.needle_p,
+            m.needle_length,
+            ignore_case,
+            m.rightmost_match_p
+        )) {
+        return false;
+    }
+
+    // The matcher's haystacks have these already, but there are few enough
+    // results that it's not worth looking them up.
+    scratch->boundaries = reserve(
+        scratch->boundaries,
+        &scratch->boundaries_capacity,
+        candidate->length,
+        sizeof(uint8_t)
+    );
+    commandt_score_boundaries(
+        candidate->contents, candidate->length, scratch->boundaries
+    );
+    m.boundaries_p = scratch->boundaries;
+
+    // `iterative_match()` keeps looking for the same needle char after taking
+    // a match, so it can occasionally score a candidate in which every
+    // alignment runs into a hidden dot-file; settle for ignoring them then.
+    dot_files_t dot_files = get_dot_files(matcher);
+    return trace_positions(&m, scratch, ignore_case, dot_files, positions) ||
+        trace_positions(&m, scratch, ignore_case, DOT_FILES_SHOWN, positions);
+}
@@ -8,12 +8,156 @@
 
 #include <float.h> /* for FLT_MAX */
 #include <stdbool.h> /* for bool */
+#include <stddef.h> /* for size_t */
+#include <stdint.h> /* for UINT64_MAX, UINT8_MAX, uint64_t, uint8_t */
 
 #include "commandt.h" /* for haystack_t, matcher_t */
 
-#define UNSET_BITMASK (-1)
+#define UNSET_BITMASK UINT64_MAX
 #define UNSET_SCORE FLT_MAX
 
-float commandt_score(haystack_t *haystack, matcher_t *matcher, bool ignore_case);
+/**
+ * Reusable scratch space for the scorers returned by `commandt_scorer()`.
+ *
+ * Holds the tables needed to score a single haystack, growing as needed, so
+ * that they don't have to be allocated (or reset) for every haystack. Each
+ * thread doing scoring needs its own.
+ */
+typedef struct score_scratch_t score_scratch_t;
+
+/**
+ * Cheap facts about a haystack, from which `commandt_score_bound()` can work out
+ * an upper bound on its score without scoring it.
+ */
+typedef struct score_features_t {
+    /**
+     * Signature of the (downcased) pairs of adjacent characters in the
+     * haystack, with one bit per pair (but many pairs per bit).
+     */
+    uint64_t pairs;
+
+    // The first two (downcased) characters, or NUL if there aren't that many.
+    char head[2];
+
+    // Numbers of characters following a "/"; following a "-", "_", " " or
+    // digit, or starting a camelCase hump; and following a ".". These saturate
+    // at `UINT8_MAX`.
+    uint8_t slashes;
+    uint8_t words;
+    uint8_t dots;
+
+    bool set;
+} score_features_t;
+
+/**
+ * What comes before a haystack char, which determines how much matching it is
+ * worth when it isn't right after the previous match (see
+ * `commandt_score_boundaries()`).
+ */
+typedef enum {
+    BOUNDARY_NONE,
+    BOUNDARY_SLASH, // Follows a "/", or starts the haystack.
+    BOUNDARY_WORD, // Follows a "-", "_", " " or digit, or starts a camel hump.
+    BOUNDARY_DOT, // Follows a ".".
+} boundary_t;
+
+/**
+ * Returns a bitmask summarizing which characters appear in `str`.
+ *
+ * Every byte maps to exactly one bit: case-insensitively for letters, and one
+ * bit each for digits and for the path punctuation `.`, `_`, `-`, `/` and
+ * space, with all remaining bytes sharing a single bit. A haystack can only
+ * match a needle if its bitmask contains all of the bits in the needle's.
+ */
+uint64_t commandt_bitmask(const char *str, size_t length);
+
+/**
+ * Scores `haystack` against `matcher->needle`.
+ *
+ * If `*bitmask` is `UNSET_BITMASK`, the haystack's bitmask is computed along
+ * the way and stored there. Callers are expected to have already rejected
+ * haystacks whose known bitmask rules out a match.
+ */
+typedef float (*scorer_t)(
+    haystack_t *haystack,
+    uint64_t *bitmask,
+    matcher_t *matcher,
+    score_scratch_t *scratch
+);
+
+/**
+ * Records the `boundary_t` of each byte of `str` in `boundaries`, which must
+ * have room for `length` entries.
+ *
+ * Scorers look these up rather than inspecting the chars on either side of
+ * each match, and a haystack char with a `BOUNDARY_SLASH` is where a dot-file
+ * would start.
+ */
+void commandt_score_boundaries(
+    const char *str,
+    size_t length,
+    uint8_t *boundaries
+);
+
+/**
+ * Records the `score_features_t` of `str` in `features`.
+ */
+void commandt_score_features(
+    const char *str,
+    size_t length,
+    score_features_t *features
+);
+
+/**
+ * Returns an upper bound on the score of any haystack with the given
+ * `features`, where `max_score_per_char` is as in the scorer.
+ *
+ * Each needle char contributes the full `max_score_per_char` only if it matches
+ * right after the previous one (or, for the first char, at one of the first two
+ * positions); otherwise it starts a new run, at a discount that depends on what
+ * precedes it. Whenever a pair of adjacent needle chars can't be found next to
+ * each other in the haystack, that's another run, and there are only so many
+ * slashes and so on to go round.
+ */
+float commandt_score_bound(
+    const score_features_t *features,
+    const char *needle,
+    size_t needle_length,
+    float max_score_per_char
+);
+
+/**
+ * Returns the scorer to use for `matcher`'s current search.
+ *
+ * There is one variant for each combination of `ignore_case` and the
+ * matcher's dot-file settings, so as to keep those out of the inner loops.
+ */
+scorer_t commandt_scorer(matcher_t *matcher, bool ignore_case);
+
+/**
+ * Finds the best-scoring way of matching the chars of `matcher->needle` in
+ * `candidate`, writing their offsets to `positions` (which must have room for
+ * `matcher->needle_length` entries).
+ *
+ * This is much slower than scoring, so is meant to be used only on the handful
+ * of candidates that make it into the final results. Returns `false` if the
+ * needle doesn't match at all.
+ */
+bool commandt_score_positions(
+    str_t *candidate,
+    matcher_t *matcher,
+    bool ignore_case,
+    score_scratch_t *scratch,
+    unsigned *positions
+);
+
+/**
+ * Returns a new, empty `score_scratch_t`.
+ *
+ * The caller should dispose of it with `commandt_score_scratch_free()`.
+ */
+score_scratch_t *commandt_score_scratch_new(void);
+
+void commandt_score_scratch_free(score_scratch_t *scratch);
 
 #endif
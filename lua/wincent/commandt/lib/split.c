@@ -0,0 +1,216 @@
+/**
+ * SPDX-FileCopyrightText: Copyright 2026-present Greg Hurrell and contributors.
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include "split.h"
+
+#include <stdatomic.h> /* for atomic_load_explicit(), atomic_store_explicit() */
+#include <stdint.h> /* for uint32_t, uint64_t */
+
+#if defined(__x86_64__)
+#define SPLIT_X86
+#include <immintrin.h> /* for _mm256_cmpeq_epi8(), _mm_cmpeq_epi8() etc */
+#elif defined(__aarch64__)
+#define SPLIT_NEON
+#include <arm_neon.h> /* for vceqq_u8(), vshrn_n_u16() etc */
+#endif
+
+typedef size_t (*split_impl)(
+    const char *data,
+    size_t length,
+    char terminator,
+    unsigned *offsets,
+    size_t capacity
+);
+
+static _Atomic(split_impl) selected = NULL;
+
+// Forward declarations.
+static split_impl select_impl(void);
+
+size_t split(
+    const char *data,
+    size_t length,
+    char terminator,
+    unsigned *offsets,
+    size_t capacity
+) {
+    split_impl impl = atomic_load_explicit(&selected, memory_order_relaxed);
+    if (!impl) {
+        // Racing threads all pick the same implementation, so it doesn't
+        // matter which of them gets to store it.
+        impl = select_impl();
+        atomic_store_explicit(&selected, impl, memory_order_relaxed);
+    }
+    return impl(data, length, terminator, offsets, capacity);
+}
+
+/**
+ * Scans `data[offset]` up to (but not including) `data[length]`, carrying on
+ * from `found` offsets already written. Used on its own, and to finish off
+ * whatever is left at the end of the data after the vector implementations
+ * have consumed as many whole blocks as they can.
+ */
+static size_t split_tail(
+    const char *data,
+    size_t offset,
+    size_t length,
+    char terminator,
+    unsigned *offsets,
+    size_t found,
+    size_t capacity
+) {
+    for (size_t i = offset; i < length && found < capacity; i++) {
+        if (data[i] == terminator) {
+            offsets[found++] = i;
+        }
+    }
+    return found;
+}
+
+/**
+ * Writes the positions marked in `bits` (which has `1 << shift` bits per byte
+ * of a block starting at `base`) to `offsets`, lowest first, carrying on from
+ * `found` and stopping at `capacity`.
+ */
+static inline size_t collect(
+    uint64_t bits,
+    unsigned shift,
+    size_t base,
+    unsigned *offsets,
+    size_t found,
+    size_t capacity
+) {
+    while (bits && found < capacity) {
+        offsets[found++] = base + (__builtin_ctzll(bits) >> shift);
+        bits &= bits - 1;
+    }
+    return found;
+}
+
+// The vector implementations all work the same way: compare a block against
+// the terminator, turn the result into a mask with a bit (or nibble) per byte,
+// and then peel the set bits off it, lowest first.
+
+#ifdef SPLIT_X86
+
+static size_t split_sse2(
+    const char *data,
+    size_t length,
+    char terminator,
+    unsigned *offsets,
+    size_t capacity
+) {
+    __m128i t = _mm_set1_epi8(terminator);
+    size_t found = 0;
+    size_t base = 0;
+    for (; base + 64 <= length; base += 64) {
+        const __m128i *block = (const __m128i *)(data + base);
+        uint64_t bits = 0;
+        for (unsigned i = 0; i < 4; i++) {
+            __m128i chunk = _mm_loadu_si128(block + i);
+            uint64_t mask =
+                (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, t));
+            bits |= mask << (i * 16);
+        }
+        found = collect(bits, 0, base, offsets, found, capacity);
+        if (found == capacity) {
+            return found;
+        }
+    }
+    return split_tail(
+        data, base, length, terminator, offsets, found, capacity
+    );
+}
+
+__attribute__((target("avx2"))) static size_t split_avx2(
+    const char *data,
+    size_t length,
+    char terminator,
+    unsigned *offsets,
+    size_t capacity
+) {
+    __m256i t = _mm256_set1_epi8(terminator);
+    size_t found = 0;
+    size_t base = 0;
+    for (; base + 64 <= length; base += 64) {
+        __m256i low = _mm256_loadu_si256((const __m256i *)(data + base));
+        __m256i high = _mm256_loadu_si256((const __m256i *)(data + base + 32));
+        uint64_t bits =
+            (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(low, t)) |
+            (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(high, t))
+                << 32;
+        found = collect(bits, 0, base, offsets, found, capacity);
+        if (found == capacity) {
+            return found;
+        }
+    }
+    return split_tail(
+        data, base, length, terminator, offsets, found, capacity
+    );
+}
+
+#endif
+
+#ifdef SPLIT_NEON
+
+static size_t split_neon(
+    const char *data,
+    size_t length,
+    char terminator,
+    unsigned *offsets,
+    size_t capacity
+) {
+    uint8x16_t t = vdupq_n_u8((uint8_t)terminator);
+    size_t found = 0;
+    size_t base = 0;
+    for (; base + 16 <= length; base += 16) {
+        uint8x16_t block = vld1q_u8((const uint8_t *)(data + base));
+
+        // NEON has no movemask, so narrow each byte of the comparison to a
+        // nibble instead, and keep one bit of each.
+        uint8x8_t nibbles =
+            vshrn_n_u16(vreinterpretq_u16_u8(vceqq_u8(block, t)), 4);
+        uint64_t bits = vget_lane_u64(vreinterpret_u64_u8(nibbles), 0) &
+            0x8888888888888888;
+        found = collect(bits, 2, base, offsets, found, capacity);
+        if (found == capacity) {
+            return found;
+        }
+    }
+    return split_tail(
+        data, base, length, terminator, offsets, found, capacity
+    );
+}
+
+#endif
+
+#if !defined(SPLIT_X86) && !defined(SPLIT_NEON)
+
+static size_t split_scalar(
+    const char *data,
+    size_t length,
+    char terminator,
+    unsigned *offsets,
+    size_t capacity
+) {
+    return split_tail(data, 0, length, terminator, offsets, 0, capacity);
+}
+
+#endif
+
+static split_impl select_impl(void) {
+#if defined(SPLIT_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return split_avx2;
+    }
+    // SSE2 is part of the x86-64 baseline.
+    return split_sse2;
+#elif defined(SPLIT_NEON)
+    return split_neon;
+#else
+    return split_scalar;
+#endif
+}
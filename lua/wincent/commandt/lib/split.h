@@ -0,0 +1,43 @@
+/**
+ * SPDX-FileCopyrightText: Copyright 2026-present Greg Hurrell and contributors.
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/**
+ * @file
+ *
+ * Vectorized search for record terminators, used by the scanner to split
+ * command output into candidates a whole block at a time, instead of one
+ * `memchr()` call per record.
+ *
+ * The implementation (AVX2, SSE2, NEON or plain C) is chosen at runtime, on
+ * first use, based on what the CPU supports.
+ */
+
+#ifndef SPLIT_H
+#define SPLIT_H
+
+// Define short names for convenience, but all external symbols need prefixes.
+#define split commandt_split
+
+#include <stddef.h> /* for size_t */
+
+/**
+ * Finds occurrences of `terminator` in the `length` bytes at `data`, writing
+ * their offsets (relative to `data`), in order, to `offsets`, and stopping
+ * once `capacity` (which must be non-zero) have been found.
+ *
+ * Returns the number of offsets written. If that is `capacity`, there may be
+ * more to be found after the last one.
+ *
+ * `length` must be less than `UINT_MAX`.
+ */
+size_t split(
+    const char *data,
+    size_t length,
+    char terminator,
+    unsigned *offsets,
+    size_t capacity
+);
+
+#endif
@@ -18,7 +18,8 @@ return function(directory, command, options, name)
     max_files = get_max_files(options) or 0
   end
   local finder = {}
-  finder.scanner = require('wincent.commandt.private.scanners.exec').scanner(command, drop, max_files)
+  local terminator = options.finders[name].terminator
+  finder.scanner = require('wincent.commandt.private.scanners.exec').scanner(command, drop, max_files, terminator)
   finder.matcher = matcher_new(finder.scanner, options, { lines = vim.o.lines })
   finder.run = function(query)
     local results = matcher_run(finder.matcher, query)
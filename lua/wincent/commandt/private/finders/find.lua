@@ -9,7 +9,7 @@ local pushd = require('wincent.commandt.pushd')
 local find = {
   command = function(directory, _options)
     pushd(directory)
-    local command = 'find -L . -type f -print0 2> /dev/null'
+    local command = { 'find', '-L', '.', '-type', 'f', '-print0' }
     local drop = 2 -- drop './'
     return command, drop
   end,
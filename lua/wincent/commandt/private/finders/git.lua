@@ -6,16 +6,74 @@ local on_open = require('wincent.commandt.on_open')
 local popd = require('wincent.commandt.popd')
 local pushd = require('wincent.commandt.pushd')
 
+-- Returns the `path` entries from the `.gitmodules` file in `directory`, if it
+-- has one.
+local function read_gitmodules(directory)
+  local paths = {}
+  local file = io.open(directory .. '/.gitmodules', 'r')
+  if file then
+    for line in file:lines() do
+      local path = line:match('^%s*path%s*=%s*(.-)%s*$')
+      if path then
+        table.insert(paths, (path:gsub('^"(.*)"$', '%1')))
+      end
+    end
+    file:close()
+  end
+  return paths
+end
+
+-- Returns the paths, relative to the current directory, of the checked-out
+-- submodules (including nested ones) that live underneath it.
+--
+-- This reads the `.gitmodules` files directly instead of asking `git submodule
+-- foreach`, so that there is no extra process to wait for before the listing
+-- itself can start.
+local function get_submodules()
+  local cwd = vim.uv.cwd()
+  local root = vim.fs.root(cwd, '.git')
+  if not root then
+    return {}
+  end
+  local prefix = cwd == root and '' or cwd:sub(#root + 2) .. '/'
+  local submodules = {}
+  local function visit(directory)
+    for _, path in ipairs(read_gitmodules(root .. '/' .. directory)) do
+      local submodule = directory .. path
+      if vim.uv.fs_stat(root .. '/' .. submodule .. '/.git') then
+        if submodule:sub(1, #prefix) == prefix then
+          table.insert(submodules, submodule:sub(#prefix + 1))
+        end
+        visit(submodule .. '/')
+      end
+    end
+  end
+  visit('')
+  return submodules
+end
+
 local git = {
   command = function(directory, options)
     pushd(directory)
-    local command = 'git ls-files --exclude-standard --cached -z'
+    local command = { 'git', 'ls-files', '--exclude-standard', '--cached', '-z' }
     if options.scanners.git.submodules then
-      command = command .. ' --recurse-submodules'
+      local submodules = get_submodules()
+      if #submodules > 0 then
+        -- Rather than have `--recurse-submodules` list the submodules one
+        -- after the other, list them all at once, alongside the superproject.
+        local sources = { { command = command } }
+        for _, submodule in ipairs(submodules) do
+          table.insert(sources, {
+            command = { 'git', '-C', submodule, unpack(command, 2) },
+            prefix = submodule .. '/',
+          })
+        end
+        return sources, 0
+      end
+      table.insert(command, '--recurse-submodules')
     elseif options.scanners.git.untracked then
-      command = command .. ' --others'
+      table.insert(command, '--others')
     end
-    command = command .. ' 2> /dev/null'
     local drop = 0
     return command, drop
   end,
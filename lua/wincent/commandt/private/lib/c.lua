@@ -14,7 +14,8 @@ ffi.cdef([[
 
   typedef struct {
       str_t *candidate;
-      long bitmask;
+      const char *folded;
+      const uint8_t *boundaries;
       float score;
   } haystack_t;
 
@@ -24,29 +25,71 @@ ffi.cdef([[
       ssize_t candidates_size;
       char *buffer;
       ssize_t buffer_size;
+      void *index;
+      void *reader;
+      void *indexer;
+      char *folded;
+      size_t folded_size;
+      unsigned folded_count;
+      size_t folded_length;
+      uint8_t *boundaries;
+      size_t boundaries_size;
+      unsigned boundaries_count;
+      size_t boundaries_length;
   } scanner_t;
 
+  typedef enum {
+      SCANNER_TERMINATOR_NUL,
+      SCANNER_TERMINATOR_LF,
+      SCANNER_TERMINATOR_CRLF,
+  } scanner_terminator_t;
+
+  typedef struct {
+      const char *needle;
+      size_t needle_length;
+      unsigned *survivors;
+      unsigned survivor_count;
+  } needle_history_t;
+
   typedef struct {
       scanner_t *scanner;
       haystack_t *haystacks;
+      unsigned haystack_count;
+      uint64_t *bitmasks;
+      unsigned *lengths;
+      void *features;
       bool always_show_dot_files;
+      bool fold_candidates;
       bool ignore_case;
       bool ignore_spaces;
+      bool index_candidates;
       bool never_show_dot_files;
       bool smart_case;
+      bool record_positions;
       unsigned limit;
       unsigned threads;
+      void *pool;
+      void **scratch;
+      uint64_t generation;
       const char *needle;
       size_t needle_length;
-      long needle_bitmask;
+      uint64_t needle_bitmask;
       const char *last_needle;
       size_t last_needle_length;
+      unsigned *survivors;
+      unsigned survivor_count;
+      unsigned *next_survivors;
+      needle_history_t *history;
+      unsigned history_count;
   } matcher_t;
 
   typedef struct {
       str_t **matches;
       unsigned match_count;
       unsigned candidate_count;
+      unsigned *positions;
+      unsigned position_count;
+      bool cancelled;
   } result_t;
 
   typedef struct {
@@ -75,13 +118,17 @@ ffi.cdef([[
     uint32_t microseconds;
   } benchmark_t;
 
+  typedef void (*matcher_progress)(result_t *result, void *context);
+
   // Matcher functions.
 
   matcher_t *commandt_matcher_new(
       scanner_t *scanner,
       bool always_show_dot_files,
+      bool fold_candidates,
       bool ignore_case,
       bool ignore_spaces,
+      bool index_candidates,
       unsigned limit,
       bool never_show_dot_files,
       bool smart_case,
@@ -89,15 +136,49 @@ ffi.cdef([[
   );
   void commandt_matcher_free(matcher_t *matcher);
   result_t *commandt_matcher_run(matcher_t *matcher, const char *needle);
+  result_t *commandt_matcher_run_generation(
+      matcher_t *matcher,
+      const char *needle,
+      uint64_t generation
+  );
+  result_t *commandt_matcher_run_streaming(
+      matcher_t *matcher,
+      const char *needle,
+      uint64_t generation,
+      unsigned interval,
+      matcher_progress progress,
+      void *context
+  );
+  void commandt_matcher_cancel(matcher_t *matcher, uint64_t generation);
   void commandt_result_free(result_t *result);
 
   // Scanner functions.
 
   scanner_t *commandt_file_scanner(const char *directory, unsigned max_files);
-  scanner_t *commandt_scanner_new_command(const char *command, unsigned drop, unsigned max_files);
+  scanner_t *commandt_scanner_new_argv(
+      const char **argv,
+      unsigned drop,
+      unsigned max_files,
+      scanner_terminator_t terminator
+  );
+  scanner_t *commandt_scanner_new_command(
+      const char *command,
+      unsigned drop,
+      unsigned max_files,
+      scanner_terminator_t terminator
+  );
   scanner_t *commandt_scanner_new_copy(const char **candidates, unsigned count);
+  scanner_t *commandt_scanner_new_multi(
+      unsigned count,
+      const char **argvs,
+      const char **prefixes,
+      unsigned drop,
+      unsigned max_files,
+      scanner_terminator_t terminator
+  );
   scanner_t *commandt_scanner_new_str(str_t *candidates, unsigned count);
   void commandt_scanner_free(scanner_t *scanner);
+  void commandt_scanner_wait(scanner_t *scanner, unsigned count);
   void commandt_print_scanner(scanner_t *scanner);
 
   // Watchman functions.
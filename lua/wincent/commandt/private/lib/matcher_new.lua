@@ -21,9 +21,11 @@ end
 
 local function matcher_new(scanner, options, context)
   local always_show_dot_files = fetch(options, 'always_show_dot_files', false)
+  local fold_candidates = fetch(options, 'fold_candidates', true)
   local ignore_case = fetch(options, 'ignore_case', true)
   local ignore_spaces = fetch(options, 'ignore_spaces', true)
   local height = fetch(options, 'height', 15)
+  local index_candidates = fetch(options, 'index_candidates', true)
   local limit = math.min(height, context and context.lines or 1000)
   local never_show_dot_files = fetch(options, 'never_show_dot_files', false)
   local smart_case = fetch(options, 'smart_case', true)
@@ -40,8 +42,10 @@ local function matcher_new(scanner, options, context)
   local matcher = c.commandt_matcher_new(
     scanner,
     always_show_dot_files,
+    fold_candidates,
     ignore_case,
     ignore_spaces,
+    index_candidates,
     limit,
     never_show_dot_files,
     smart_case,
@@ -5,13 +5,55 @@ local ffi = require('ffi')
 
 local c = require('wincent.commandt.private.lib.c')
 
-local function scanner_new_exec(command, drop, max_files)
+-- The FFI converts these names into the corresponding `scanner_terminator_t`
+-- values.
+local terminators = {
+  crlf = 'SCANNER_TERMINATOR_CRLF',
+  lf = 'SCANNER_TERMINATOR_LF',
+  nul = 'SCANNER_TERMINATOR_NUL',
+}
+
+local function scanner_new_exec(command, drop, max_files, terminator)
   -- Note that the C-level function would ideally be named
   -- `commandt_scanner_new_exec()`, for consistency, but I am keeping the old
   -- name because I don't want to break userspace (ie. by forcing users to do a
   -- rebuild) just because I felt like refactoring some internal implementation
   -- details...
-  local scanner = c.commandt_scanner_new_command(command, drop or 0, max_files or 0)
+  local scanner
+  terminator = terminators[terminator or 'nul']
+  if type(command) == 'table' and type(command[1]) == 'table' then
+    -- A list of sources, each a list of words in `command` and an optional
+    -- `prefix`, to be run all at once. Their words go into one array, with a
+    -- NULL (left there by `ffi.new()`) after each command's last word.
+    local size = 0
+    for _, source in ipairs(command) do
+      size = size + #source.command + 1
+    end
+    local argvs = ffi.new('const char *[?]', size)
+    local prefixes = ffi.new('const char *[?]', #command)
+    local index = 0
+    for i, source in ipairs(command) do
+      for _, word in ipairs(source.command) do
+        argvs[index] = word
+        index = index + 1
+      end
+      index = index + 1
+      prefixes[i - 1] = source.prefix
+    end
+    scanner = c.commandt_scanner_new_multi(#command, argvs, prefixes, drop or 0, max_files or 0, terminator)
+  elseif type(command) == 'table' then
+    -- A list of words: run it directly, without going through a shell. Fill in
+    -- the words one by one (passing `command` as an initializer to `ffi.new()`
+    -- would repeat a lone word into the last slot), then NULL-terminate.
+    local argv = ffi.new('const char *[?]', #command + 1)
+    for i, word in ipairs(command) do
+      argv[i - 1] = word
+    end
+    argv[#command] = nil
+    scanner = c.commandt_scanner_new_argv(argv, drop or 0, max_files or 0, terminator)
+  else
+    scanner = c.commandt_scanner_new_command(command, drop or 0, max_files or 0, terminator)
+  end
   ffi.gc(scanner, c.commandt_scanner_free)
   return scanner
 end
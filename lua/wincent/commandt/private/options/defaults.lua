@@ -28,6 +28,7 @@ function Defaults.new()
       search = require('wincent.commandt.private.finders.search'),
       tag = require('wincent.commandt.private.finders.tag'),
     },
+    fold_candidates = true,
     height = 15,
 
     -- If nil, will infer from Neovim's `'ignorecase'`.
@@ -35,6 +36,7 @@ function Defaults.new()
       return vim.o.ignorecase
     end,
     ignore_spaces = true,
+    index_candidates = true,
 
     -- Note that because of the way we merge mappings recursively, you can _add_
     -- or _replace_ a mapping easily, but to _remove_ it you have to assign it to
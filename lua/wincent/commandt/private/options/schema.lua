@@ -12,14 +12,17 @@ local types = require('wincent.commandt.private.options.types')
 ---    on_close?: fun(),
 ---    on_directory?: fun(),
 ---    options?: fun(),
----    command?: fun() | string,
+---    command?: fun() | string | string[],
 ---    fallback?: boolean,
 ---    max_files?: (fun(): number) | number,
 ---    open?: fun(),
+---    terminator?: TerminatorOption,
 ---  }>,
+---  fold_candidates?: boolean,
 ---  height?: number,
 ---  ignore_case?: boolean | fun(),
 ---  ignore_spaces?: boolean,
+---  index_candidates?: boolean,
 ---  mappings?: MappingsOption,
 ---  margin?: number,
 ---  match_listing?: {
@@ -88,6 +91,10 @@ local schema = {
               one_of = {
                 { kind = 'function' },
                 { kind = 'string' },
+                {
+                  kind = 'list',
+                  of = { kind = 'string' },
+                },
               },
             },
             optional = true,
@@ -103,6 +110,7 @@ local schema = {
             optional = true,
           },
           open = { kind = 'function', optional = true },
+          terminator = types.terminator,
         },
       },
       meta = function(t, report)
@@ -119,10 +127,15 @@ local schema = {
             if value.candidates and value.max_files then
               report(string.format('%s: `max_files` has no effect if `candidates` set', key))
             end
+
+            if value.candidates and value.terminator then
+              report(string.format('%s: `terminator` has no effect if `candidates` set', key))
+            end
           end
         end
       end,
     },
+    fold_candidates = { kind = 'boolean' },
     height = types.height,
     ignore_case = {
       kind = {
@@ -138,6 +151,7 @@ local schema = {
       optional = true,
     },
     ignore_spaces = { kind = 'boolean' },
+    index_candidates = { kind = 'boolean' },
     mappings = types.mappings,
     margin = types.margin,
     match_listing = {
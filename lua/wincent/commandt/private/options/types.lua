@@ -54,6 +54,9 @@ local order = { kind = { one_of = { 'forward', 'reverse' } } }
 ---@alias PositionOption 'bottom' | 'center' | 'top'
 local position = { kind = { one_of = { 'bottom', 'center', 'top' } } }
 
+---@alias TerminatorOption 'crlf' | 'lf' | 'nul'
+local terminator = { kind = { one_of = { 'crlf', 'lf', 'nul' } }, optional = true }
+
 ---@alias TraverseOption 'file' | 'pwd' | 'none'
 local traverse = { kind = { one_of = { 'file', 'pwd', 'none' } } }
 
@@ -101,6 +104,7 @@ return {
   mode = mode,
   order = order,
   position = position,
+  terminator = terminator,
   traverse = traverse,
   truncate = truncate,
 }
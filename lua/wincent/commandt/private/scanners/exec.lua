@@ -3,9 +3,9 @@
 
 local M = {}
 
-M.scanner = function(user_command, drop, max_files)
+M.scanner = function(user_command, drop, max_files, terminator)
   local scanner_new_exec = require('wincent.commandt.private.lib.scanner_new_exec')
-  local scanner = scanner_new_exec(user_command, drop, max_files)
+  local scanner = scanner_new_exec(user_command, drop, max_files, terminator)
   return scanner
 end
 
@@ -11,14 +11,25 @@ local fixtures = require('wincent.commandt.test.fixtures')
 --- }
 
 describe('matcher.c', function()
+  local c = require('wincent.commandt.private.lib.c')
   local matcher_new = require('wincent.commandt.private.lib.matcher_new')
   local matcher_run = require('wincent.commandt.private.lib.matcher_run')
   local scanner_new_copy = require('wincent.commandt.private.lib.scanner_new_copy')
 
+  local function get_strings(results)
+    local strings = {}
+    for k = 0, results.match_count - 1 do
+      local str = results.matches[k]
+      table.insert(strings, ffi.string(str.contents, str.length))
+    end
+    return strings
+  end
+
   --- @param paths string[]
   --- @param options? {
   ---   height?: number,
   ---   ignore_case?: boolean,
+  ---   index_candidates?: boolean,
   ---   ignore_spaces?: boolean,
   ---   smart_case?: boolean,
   --- }
@@ -29,13 +40,7 @@ describe('matcher.c', function()
     local matcher = matcher_new(scanner, options)
     return {
       match = function(query)
-        local results = matcher_run(matcher, query)
-        local strings = {}
-        for k = 0, results.match_count - 1 do
-          local str = results.matches[k]
-          table.insert(strings, ffi.string(str.contents, str.length))
-        end
-        return strings
+        return get_strings(matcher_run(matcher, query))
       end,
       _scanner = scanner, -- Prevent premature GC.
       _matcher = matcher, -- Prevent premature GC.
@@ -963,4 +968,186 @@ describe('matcher.c', function()
       end)
     end)
   end)
+
+  context('after a backspace', function()
+    local paths = { 'abc/one', 'ab/two', 'a/three', 'abd/four', 'xyz' }
+
+    it('returns the same results as a fresh matcher', function()
+      local matcher = get_matcher(paths)
+      matcher.match('a')
+      matcher.match('ab')
+      matcher.match('abc')
+      expect(matcher.match('ab')).to_equal(get_matcher(paths).match('ab'))
+      expect(matcher.match('abd')).to_equal(get_matcher(paths).match('abd'))
+      expect(matcher.match('a')).to_equal(get_matcher(paths).match('a'))
+    end)
+
+    it('forgets needles that are no longer prefixes', function()
+      local matcher = get_matcher(paths)
+      matcher.match('a')
+      matcher.match('ab')
+      matcher.match('abc')
+      expect(matcher._matcher.history_count).to_be(3)
+      matcher.match('ab')
+      expect(matcher._matcher.history_count).to_be(2)
+      matcher.match('abd')
+      expect(matcher._matcher.history_count).to_be(3)
+      local top = matcher._matcher.history[2]
+      expect(ffi.string(top.needle, top.needle_length)).to_equal('abd')
+    end)
+
+    context('when more needles have been typed than can be remembered', function()
+      -- Each needle rules out one more path than the one before it.
+      local needle = 'abcdefghijklmnopqrst'
+      local long_paths = {}
+      for i = 0, #needle do
+        table.insert(long_paths, needle:sub(1, i) .. 'x')
+      end
+
+      it('drops the oldest needles', function()
+        local matcher = get_matcher(long_paths, { height = 25 })
+        for i = 1, #needle do
+          matcher.match(needle:sub(1, i))
+        end
+        expect(matcher._matcher.history_count).to_be(16)
+        local bottom = matcher._matcher.history[0]
+        expect(ffi.string(bottom.needle, bottom.needle_length)).to_equal('abcde')
+      end)
+
+      it('still returns the same results as a fresh matcher', function()
+        local matcher = get_matcher(long_paths, { height = 25 })
+        for i = 1, #needle do
+          matcher.match(needle:sub(1, i))
+        end
+        expect(matcher.match('abc')).to_equal(get_matcher(long_paths, { height = 25 }).match('abc'))
+        expect(matcher._matcher.history_count).to_be(1)
+      end)
+    end)
+  end)
+
+  context('with cancellation', function()
+    local paths = {}
+    for i = 1, 300 do
+      table.insert(paths, string.format('dir%d/file%d.txt', i % 7, i))
+    end
+
+    it('returns an empty result for a run that has already been superseded', function()
+      local matcher = get_matcher(paths)
+      c.commandt_matcher_cancel(matcher._matcher, 2)
+      local results = c.commandt_matcher_run_generation(matcher._matcher, 'f1', 1)
+      expect(results.cancelled).to_be(true)
+      expect(results.match_count).to_be(0)
+      c.commandt_result_free(results)
+    end)
+
+    it('does not disturb later runs', function()
+      local matcher = get_matcher(paths)
+      matcher.match('f')
+      matcher.match('f1')
+      c.commandt_matcher_cancel(matcher._matcher, 1)
+      local results = c.commandt_matcher_run_generation(matcher._matcher, 'f12', 0)
+      expect(results.cancelled).to_be(true)
+      c.commandt_result_free(results)
+      expect(matcher.match('f12')).to_equal(get_matcher(paths).match('f12'))
+      expect(matcher.match('f1')).to_equal(get_matcher(paths).match('f1'))
+      expect(matcher.match('d3')).to_equal(get_matcher(paths).match('d3'))
+    end)
+  end)
+
+  context('when streaming', function()
+    local paths = {}
+    for i = 1, 300 do
+      table.insert(paths, string.format('dir%d/file%d.txt', i % 7, i))
+    end
+
+    it('reports provisional results that end with the final ones', function()
+      local matcher = get_matcher(paths)
+      local snapshots = {}
+      local progress = ffi.cast('matcher_progress', function(results)
+        table.insert(snapshots, get_strings(results))
+      end)
+      local results = c.commandt_matcher_run_streaming(matcher._matcher, 'f1', 0, 1, progress, nil)
+      progress:free()
+      expect(#snapshots > 1).to_be(true)
+      expect(snapshots[#snapshots]).to_equal(get_strings(results))
+      expect(get_strings(results)).to_equal(get_matcher(paths).match('f1'))
+      c.commandt_result_free(results)
+    end)
+
+    it('can be cancelled part-way through', function()
+      local matcher = get_matcher(paths)
+      matcher.match('f')
+      local calls = 0
+      local progress = ffi.cast('matcher_progress', function()
+        calls = calls + 1
+        c.commandt_matcher_cancel(matcher._matcher, 1)
+      end)
+      local results = c.commandt_matcher_run_streaming(matcher._matcher, 'f1', 0, 1, progress, nil)
+      progress:free()
+      expect(calls).to_be(1)
+      expect(results.cancelled).to_be(true)
+      expect(results.match_count).to_be(0)
+      c.commandt_result_free(results)
+      expect(matcher.match('f1')).to_equal(get_matcher(paths).match('f1'))
+      expect(matcher.match('f')).to_equal(get_matcher(paths).match('f'))
+    end)
+  end)
+
+  context('with `record_positions` set', function()
+    local function get_positions(paths, query)
+      local matcher = get_matcher(paths)
+      matcher._matcher.record_positions = true
+      local results = matcher_run(matcher._matcher, query)
+      local positions = {}
+      for i = 0, results.match_count - 1 do
+        local row = {}
+        for j = 0, results.position_count - 1 do
+          table.insert(row, results.positions[i * results.position_count + j])
+        end
+        positions[ffi.string(results.matches[i].contents, results.matches[i].length)] = row
+      end
+      return positions
+    end
+
+    it('records where each match matched', function()
+      expect(get_positions({ 'foo/bar', 'bing' }, 'fb')).to_equal({ ['foo/bar'] = { 0, 4 } })
+    end)
+
+    it('prefers positions at the start of words', function()
+      expect(get_positions({ 'xxxab/b' }, 'b')).to_equal({ ['xxxab/b'] = { 6 } })
+    end)
+
+    it('records nothing for an empty query', function()
+      local matcher = get_matcher({ 'foo' })
+      matcher._matcher.record_positions = true
+      local results = matcher_run(matcher._matcher, '')
+      expect(results.positions == nil).to_be(true)
+      expect(results.position_count).to_be(0)
+    end)
+  end)
+
+  context('with enough candidates to index', function()
+    local paths = {}
+    for i = 1, 100000 do
+      table.insert(paths, string.format('dir%d/sub%d/file%d.txt', i % 97, i % 13, i))
+    end
+
+    it('builds the index in the background, and uses it once it is ready', function()
+      local matcher = get_matcher(paths)
+      local expected = matcher.match('b99')
+      local started = os.time()
+      while matcher._scanner.index == nil and os.time() - started < 10 do
+        matcher.match('')
+      end
+      expect(matcher._scanner.index ~= nil).to_be(true)
+      expect(matcher.match('b99')).to_equal(expected)
+    end)
+
+    it('does without the index when `index_candidates` is `false`', function()
+      local matcher = get_matcher(paths, { index_candidates = false })
+      matcher.match('b99')
+      expect(matcher._scanner.indexer == nil).to_be(true)
+      expect(matcher._scanner.index == nil).to_be(true)
+    end)
+  end)
 end)
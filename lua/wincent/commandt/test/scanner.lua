@@ -0,0 +1,119 @@
+-- SPDX-FileCopyrightText: Copyright 2026-present Greg Hurrell and contributors.
+-- SPDX-License-Identifier: BSD-2-Clause
+
+local ffi = require('ffi')
+
+describe('scanner.c', function()
+  local c = require('wincent.commandt.private.lib.c')
+  local scanner_new_exec = require('wincent.commandt.private.lib.scanner_new_exec')
+
+  local UINT_MAX = 0xffffffff
+
+  --- @param scanner userdata
+  --- @return string[]
+  local function get_candidates(scanner)
+    local candidates = {}
+    for i = 0, scanner.count - 1 do
+      local str = scanner.candidates[i]
+      table.insert(candidates, ffi.string(str.contents, str.length))
+    end
+    return candidates
+  end
+
+  context('with a command that is still running', function()
+    it('takes in output as it arrives', function()
+      local scanner = scanner_new_exec([[printf 'a\0b\0'; sleep 0.5; printf 'c\0']])
+      c.commandt_scanner_wait(scanner, 2)
+      expect(get_candidates(scanner)).to_equal({ 'a', 'b' })
+      c.commandt_scanner_wait(scanner, UINT_MAX)
+      expect(get_candidates(scanner)).to_equal({ 'a', 'b', 'c' })
+    end)
+
+    it('stops waiting once the command has finished', function()
+      local scanner = scanner_new_exec([[printf 'a\0']])
+      c.commandt_scanner_wait(scanner, 10)
+      expect(get_candidates(scanner)).to_equal({ 'a' })
+    end)
+
+    it('stops the command once it has produced `max_files` candidates', function()
+      local started = os.time()
+      local scanner = scanner_new_exec([[printf 'a\nb\nc\n'; sleep 30]], 0, 2, 'lf')
+      c.commandt_scanner_wait(scanner, UINT_MAX)
+      expect(get_candidates(scanner)).to_equal({ 'a', 'b' })
+      expect(os.time() - started < 10).to_be(true)
+    end)
+  end)
+
+  context('with a terminator', function()
+    local function scan(output, terminator)
+      local scanner = scanner_new_exec({ 'printf', output }, 0, 0, terminator)
+      c.commandt_scanner_wait(scanner, UINT_MAX)
+      return get_candidates(scanner)
+    end
+
+    it('splits on NUL by default', function()
+      expect(scan('a\\0b c\\0d\\n')).to_equal({ 'a', 'b c', 'd\n' })
+    end)
+
+    it('splits on LF', function()
+      expect(scan('a\\nb c\\nd\\n', 'lf')).to_equal({ 'a', 'b c', 'd' })
+    end)
+
+    it('splits on CRLF', function()
+      expect(scan('a\\r\\nb\\rc\\r\\nd\\r\\n', 'crlf')).to_equal({ 'a', 'b\rc', 'd' })
+    end)
+
+    it('takes a trailing record that has no terminator', function()
+      expect(scan('a\\0b', 'nul')).to_equal({ 'a', 'b' })
+      expect(scan('a\\nb', 'lf')).to_equal({ 'a', 'b' })
+      expect(scan('a\\r\\nb', 'crlf')).to_equal({ 'a', 'b' })
+    end)
+
+    it('skips empty records', function()
+      expect(scan('a\\n\\nb\\n', 'lf')).to_equal({ 'a', 'b' })
+      expect(scan('a\\r\\n\\r\\nb\\r\\n', 'crlf')).to_equal({ 'a', 'b' })
+    end)
+  end)
+
+  context('with several sources', function()
+    local function scan(sources, max_files)
+      local scanner = scanner_new_exec(sources, 0, max_files)
+      c.commandt_scanner_wait(scanner, UINT_MAX)
+      local candidates = get_candidates(scanner)
+      table.sort(candidates)
+      return candidates
+    end
+
+    it("puts each source's prefix in front of its candidates", function()
+      expect(scan({
+        { command = { 'printf', 'a\\0b\\0' } },
+        { command = { 'printf', 'c\\0' }, prefix = 'one/' },
+        { command = { 'printf', 'd\\0e\\0' }, prefix = 'one/two/' },
+      })).to_equal({ 'a', 'b', 'one/c', 'one/two/d', 'one/two/e' })
+    end)
+
+    it('skips candidates that are the root of another source', function()
+      expect(scan({
+        { command = { 'printf', 'a\\0one\\0' } },
+        { command = { 'printf', 'b\\0two\\0' }, prefix = 'one/' },
+        { command = { 'printf', 'c\\0' }, prefix = 'one/two/' },
+      })).to_equal({ 'a', 'one/b', 'one/two/c' })
+    end)
+
+    it('stops at `max_files` in total', function()
+      expect(#scan({
+        { command = { 'printf', 'a\\0b\\0c\\0' } },
+        { command = { 'printf', 'd\\0e\\0f\\0' }, prefix = 'one/' },
+      }, 4)).to_be(4)
+    end)
+
+    it('stops the commands once there are `max_files` candidates', function()
+      local started = os.time()
+      expect(#scan({
+        { command = { 'sh', '-c', [[printf 'a\0b\0'; sleep 30]] } },
+        { command = { 'sh', '-c', [[printf 'c\0d\0'; sleep 30]] }, prefix = 'one/' },
+      }, 3)).to_be(3)
+      expect(os.time() - started < 10).to_be(true)
+    end)
+  end)
+end)